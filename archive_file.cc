@@ -1,5 +1,7 @@
 #include "mold.h"
 
+#include <unordered_map>
+
 struct ArHdr {
   char ar_name[16];
   char ar_date[12];
@@ -12,7 +14,7 @@ struct ArHdr {
 
 std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb) {
   u8 *data = mb->data() + 8;
-  std::vector<MemoryMappedFile *> vec;
+  std::vector<std::string> paths;
   std::string_view strtab;
   std::string basedir = mb->name.substr(0, mb->name.find_last_of('/'));
 
@@ -23,12 +25,12 @@ std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb)
 
     if (!memcmp(hdr.ar_name, "// ", 3)) {
       strtab = {(char *)body, size};
-      data = body + size;
+      data = body + align_to(size, 2);
       continue;
     }
 
-    if (!memcmp(hdr.ar_name, "/ ", 2)) {
-      data = body + size;
+    if (!memcmp(hdr.ar_name, "/ ", 2) || !memcmp(hdr.ar_name, "/SYM64/ ", 8)) {
+      data = body + align_to(size, 2);
       continue;
     }
 
@@ -38,9 +40,13 @@ std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb)
     const char *start = strtab.data() + atoi(hdr.ar_name + 1);
     std::string name(start, strstr(start, "/\n"));
 
-    vec.push_back(MemoryMappedFile::must_open(basedir + "/" + name));
+    paths.push_back(basedir + "/" + name);
     data = body;
   }
+
+  std::vector<MemoryMappedFile *> vec;
+  for (std::string &path : paths)
+    vec.push_back(MemoryMappedFile::must_open(path));
   return vec;
 }
 
@@ -53,14 +59,15 @@ std::vector<MemoryMappedFile *> read_fat_archive_members(MemoryMappedFile *mb) {
     ArHdr &hdr = *(ArHdr *)data;
     u8 *body = data + sizeof(hdr);
     u64 size = atol(hdr.ar_size);
-    data = body + size;
+    data = body + align_to(size, 2);
 
     if (!memcmp(hdr.ar_name, "// ", 3)) {
       strtab = {(char *)body, size};
       continue;
     }
 
-    if (!memcmp(hdr.ar_name, "/ ", 2) || !memcmp(hdr.ar_name, "__.SYMDEF/", 10))
+    if (!memcmp(hdr.ar_name, "/ ", 2) || !memcmp(hdr.ar_name, "/SYM64/ ", 8) ||
+        !memcmp(hdr.ar_name, "__.SYMDEF/", 10))
       continue;
 
     std::string name;
@@ -77,6 +84,76 @@ std::vector<MemoryMappedFile *> read_fat_archive_members(MemoryMappedFile *mb) {
   return vec;
 }
 
+static u64 read_be(u8 *p, i64 size) {
+  u64 val = 0;
+  for (i64 i = 0; i < size; i++)
+    val = (val << 8) | p[i];
+  return val;
+}
+
+// An archive file usually contains a symbol table (a member named "/"
+// or "/SYM64/") which maps defined symbol names to members defining
+// them. This function reads the table and returns symbol names for
+// each member, so that we can resolve symbols without parsing members.
+// The returned vector is indexed in the same order as members returned
+// by read_archive_members(). If there's no symbol table, an empty
+// vector is returned.
+std::vector<std::vector<std::string_view>>
+read_archive_symtab(MemoryMappedFile *mb) {
+  bool is_thin = !memcmp(mb->data(), "!<thin>\n", 8);
+  u8 *data = mb->data() + 8;
+  u8 *symtab = nullptr;
+  i64 symtab_size = 0;
+  i64 word_size = 4;
+  std::unordered_map<i64, i64> offset_to_idx;
+
+  while (data < mb->data() + mb->size()) {
+    ArHdr &hdr = *(ArHdr *)data;
+    u8 *body = data + sizeof(hdr);
+    u64 size = atol(hdr.ar_size);
+    i64 offset = data - mb->data();
+
+    if (!memcmp(hdr.ar_name, "// ", 3) || !memcmp(hdr.ar_name, "__.SYMDEF/", 10)) {
+      data = body + align_to(size, 2);
+    } else if (!memcmp(hdr.ar_name, "/ ", 2) ||
+               !memcmp(hdr.ar_name, "/SYM64/ ", 8)) {
+      symtab = body;
+      symtab_size = size;
+      word_size = (hdr.ar_name[1] == ' ') ? 4 : 8;
+      data = body + align_to(size, 2);
+    } else {
+      i64 idx = offset_to_idx.size();
+      offset_to_idx[offset] = idx;
+      data = is_thin ? body : body + align_to(size, 2);
+    }
+  }
+
+  if (!symtab)
+    return {};
+
+  std::vector<std::vector<std::string_view>> vec(offset_to_idx.size());
+  i64 num_syms = read_be(symtab, word_size);
+  u8 *offsets = symtab + word_size;
+  const char *names = (char *)offsets + num_syms * word_size;
+  const char *end = (char *)symtab + symtab_size;
+
+  if (end < names)
+    Fatal() << mb->name << ": corrupted archive symbol table";
+
+  for (i64 i = 0; i < num_syms; i++) {
+    std::string_view name(names, strnlen(names, end - names));
+    names += name.size() + 1;
+    if (end < names)
+      Fatal() << mb->name << ": corrupted archive symbol table";
+
+    auto it = offset_to_idx.find(read_be(offsets + i * word_size, word_size));
+    if (it == offset_to_idx.end())
+      Fatal() << mb->name << ": bad member offset in archive symbol table";
+    vec[it->second].push_back(name);
+  }
+  return vec;
+}
+
 std::vector<MemoryMappedFile *> read_archive_members(MemoryMappedFile *mb) {
   if (mb->size() < 8)
     Fatal() << mb->name << ": not an archive file";
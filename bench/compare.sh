@@ -0,0 +1,59 @@
+#!/bin/bash
+# Compares two results of run.sh and prints the wall-clock time and
+# the time of each phase that is slower than the baseline by more than
+# THRESHOLD percent. Exits with 1 if there's a regression in
+# wall-clock time.
+#
+# Usage: compare.sh BASELINE RESULT [THRESHOLD]
+set -e
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 BASELINE RESULT [THRESHOLD]" >&2
+  exit 1
+fi
+
+awk -v threshold=${3:-10} '
+# Returns the string between `begin` and `end` in `str`.
+function extract(str, begin, end,    s) {
+  s = substr(str, index(str, begin) + length(begin))
+  return substr(s, 1, index(s, end) - 1)
+}
+
+{
+  flags = extract($0, "\"flags\":\"", "\"")
+  key = (flags == "" ? "default" : flags) " threads=" extract($0, "\"threads\":", ",")
+  real = extract($0, "\"real\":", ",")
+  n = split(extract($0, "\"phases\":{", "}"), phases, ",")
+
+  if (FILENAME == ARGV[1]) {
+    base[key] = real
+    for (i = 1; i <= n; i++) {
+      split(phases[i], kv, ":")
+      base[key, kv[1]] = kv[2]
+    }
+    next
+  }
+
+  if (!(key in base)) {
+    printf "%-40s not in baseline\n", key
+    next
+  }
+
+  printf "%-40s %9.3f -> %9.3f  %+6.1f%%\n", key, base[key], real,
+    (real / base[key] - 1) * 100
+  if (real > base[key] * (1 + threshold / 100))
+    regressed = 1
+
+  for (i = 1; i <= n; i++) {
+    split(phases[i], kv, ":")
+    b = base[key, kv[1]]
+    if (b > 0 && kv[2] > b * (1 + threshold / 100) && kv[2] - b > 0.001) {
+      gsub("\"", "", kv[1])
+      printf "  %-38s %9.3f -> %9.3f  %+6.1f%%\n", kv[1], b, kv[2],
+        (kv[2] / b - 1) * 100
+    }
+  }
+}
+
+END { exit regressed }
+' "$1" "$2"
@@ -0,0 +1,165 @@
+#!/bin/bash
+# Generates a synthetic workload for benchmarking in a given directory.
+# The output depends only on the parameters below, so the same
+# parameters always produce the same inputs.
+#
+#   NUM_OBJS       number of object files
+#   NUM_SECTIONS   functions (and thus .text sections) per object file
+#   NUM_COMDATS    COMDAT functions per object file, picked from a pool
+#                  of COMDAT_POOL functions, so most of them are duplicates
+#   NUM_STRINGS    mergeable strings per object file, picked from a pool
+#                  of STRING_POOL strings
+#   NUM_MEMBERS    archive members, only some of which are extracted
+#   NUM_EXPORTS    functions exported by a shared library
+#
+# Each function has CFI directives, so each object file also has a
+# large .eh_frame like C++ code does. Half of the functions are not
+# reachable from main, and many of them are identical, so that
+# --gc-sections and --icf have something to do.
+set -e
+
+dir=$1
+if [ -z "$dir" ]; then
+  echo "Usage: $0 DIR" >&2
+  exit 1
+fi
+
+: ${NUM_OBJS:=200}
+: ${NUM_SECTIONS:=200}
+: ${NUM_COMDATS:=100}
+: ${COMDAT_POOL:=1000}
+: ${NUM_STRINGS:=200}
+: ${STRING_POOL:=5000}
+: ${NUM_MEMBERS:=200}
+: ${NUM_EXPORTS:=10000}
+
+params="$NUM_OBJS $NUM_SECTIONS $NUM_COMDATS $COMDAT_POOL $NUM_STRINGS"
+params="$params $STRING_POOL $NUM_MEMBERS $NUM_EXPORTS"
+
+# Skip if the workload has already been generated with the same parameters.
+if [ "$(cat $dir/params 2> /dev/null)" = "$params" ]; then
+  exit 0
+fi
+
+rm -rf $dir
+mkdir -p $dir/src
+
+# Object files
+awk -v num_objs=$NUM_OBJS -v num_sections=$NUM_SECTIONS \
+    -v num_comdats=$NUM_COMDATS -v comdat_pool=$COMDAT_POOL \
+    -v num_strings=$NUM_STRINGS -v string_pool=$STRING_POOL \
+    -v num_exports=$NUM_EXPORTS -v dir=$dir/src '
+function func_begin(out, name) {
+  print "  .type " name ",@function" > out
+  print name ":" > out
+  print "  .cfi_startproc" > out
+  print "  push %rbp" > out
+  print "  .cfi_def_cfa_offset 16" > out
+  print "  .cfi_offset %rbp, -16" > out
+}
+
+function func_end(out) {
+  print "  pop %rbp" > out
+  print "  .cfi_def_cfa_offset 8" > out
+  print "  ret" > out
+  print "  .cfi_endproc" > out
+}
+
+BEGIN {
+  for (i = 0; i < num_objs; i++) {
+    out = sprintf("%s/obj%d.s", dir, i);
+
+    for (j = 0; j < num_sections; j++) {
+      name = sprintf("f_%d_%d", i, j);
+      print "  .section .text." name ",\"ax\",@progbits" > out
+      print "  .globl " name > out
+      func_begin(out, name);
+
+      # Only the first half of the functions is reachable from main.
+      if (j < num_sections / 2 - 1)
+        printf "  call f_%d_%d\n", i, j + 1 > out
+      else if (j == num_sections / 2 - 1 && i + 1 < num_objs)
+        printf "  call f_%d_0\n", i + 1 > out
+
+      # Functions with the same j % 10 are identical except for the
+      # calls above.
+      printf "  call g_%d\n", (i * 7 + j) % comdat_pool > out
+      printf "  call d_%d@PLT\n", (i * num_sections + j) % num_exports > out
+      printf "  lea .Lstr_%d(%%rip), %%rax\n", j % num_strings > out
+      printf "  mov $%d, %%eax\n", j % 10 > out
+      func_end(out);
+    }
+
+    for (j = 0; j < num_comdats; j++) {
+      name = sprintf("g_%d", (i * 7 + j) % comdat_pool);
+      print "  .section .text." name ",\"axG\",@progbits," name ",comdat" > out
+      print "  .weak " name > out
+      func_begin(out, name);
+      func_end(out);
+    }
+
+    print "  .section .rodata.str1.1,\"aMS\",@progbits,1" > out
+    for (j = 0; j < num_strings; j++) {
+      printf ".Lstr_%d:\n", j > out
+      printf "  .string \"synthetic benchmark string number %d\"\n",
+        (i * 13 + j) % string_pool > out
+    }
+
+    print "  .section .note.GNU-stack,\"\",@progbits" > out
+    close(out);
+  }
+}'
+
+# Archive members. Only the first half is pulled in from main.
+awk -v num_members=$NUM_MEMBERS -v dir=$dir/src '
+BEGIN {
+  for (i = 0; i < num_members; i++) {
+    out = sprintf("%s/member%d.s", dir, i);
+    print "  .text" > out
+    printf "  .globl a_%d\n", i > out
+    printf "a_%d:\n", i > out
+    print "  .cfi_startproc" > out
+    if (i < num_members / 2 - 1)
+      printf "  call a_%d\n", i + 1 > out
+    print "  ret" > out
+    print "  .cfi_endproc" > out
+    print "  .section .note.GNU-stack,\"\",@progbits" > out
+    close(out);
+  }
+}'
+
+# Shared library
+awk -v num_exports=$NUM_EXPORTS -v dir=$dir/src '
+BEGIN {
+  out = dir "/dso.s";
+  print "  .text" > out
+  for (i = 0; i < num_exports; i++) {
+    printf "  .globl d_%d\n  .type d_%d,@function\nd_%d:\n  ret\n", i, i, i > out
+  }
+  print "  .section .note.GNU-stack,\"\",@progbits" > out
+}'
+
+cat <<EOF > $dir/src/main.s
+  .text
+  .globl main
+main:
+  .cfi_startproc
+  sub \$8, %rsp
+  .cfi_def_cfa_offset 16
+  call f_0_0
+  call a_0
+  xor %eax, %eax
+  add \$8, %rsp
+  .cfi_def_cfa_offset 8
+  ret
+  .cfi_endproc
+  .section .note.GNU-stack,"",@progbits
+EOF
+
+ls $dir/src/*.s | xargs -P$(nproc) -n1 sh -c 'cc -c -o ${0%.s}.o $0'
+
+mkdir -p $dir/lib
+ar rcs $dir/lib/libmember.a $dir/src/member*.o
+cc -shared -o $dir/lib/libdso.so $dir/src/dso.o
+
+echo "$params" > $dir/params
@@ -0,0 +1,118 @@
+#!/bin/bash
+# Links a synthetic workload with various options and thread counts,
+# and writes the results to a file, one JSON object per line:
+#
+#   {"flags":"--icf=all","threads":4,"real":0.123,"phases":{"parse":0.012,...}}
+#
+# "real" is the wall-clock time of the link in seconds, and "phases"
+# are the totals of mold's Timer spans recorded with --perf-trace.
+# Each configuration is run RUNS times and the fastest run is taken.
+#
+# Usage: run.sh [OUTPUT]
+#
+# The workload is generated with gen.sh, whose parameters can be set
+# via environment variables. THREADS is a list of thread counts.
+set -e
+
+out=$(realpath -m ${1:-$(dirname $0)/tmp/result.jsonl})
+
+cd $(dirname $0)
+bench=$(pwd)
+mold=$bench/../mold
+dir=$bench/tmp
+
+: ${CC:=clang}
+: ${RUNS:=5}
+: ${THREADS:="1 2 4 $(nproc)"}
+THREADS=$(echo $THREADS | tr ' ' '\n' | sort -nu | tr '\n' ' ')
+
+./gen.sh $dir/workload
+
+w=$dir/workload
+inputs="$w/src/main.o $w/src/obj*.o $w/lib/libmember.a -L$w/lib -ldso -Wl,-rpath=$w/lib"
+
+link() {
+  $CC -fuse-ld=$mold -o $dir/exe $inputs "$@"
+}
+
+now() {
+  date +%s.%N
+}
+
+# Prints "$1 - $2" in seconds.
+elapsed() {
+  awk -v a=$1 -v b=$2 'BEGIN { printf "%.6f", a - b }'
+}
+
+# Reads a --perf-trace file and prints "name seconds" for each timer.
+# Timers with the same name are summed up.
+read_trace() {
+  sed -n 's/.*"name":"\([^"]*\)","cat":"timer","ph":"X","ts":[0-9.]*,"dur":\([0-9.]*\).*/\1 \2/p' $1 |
+    awk '{ sum[$1] += $2 } END { for (k in sum) printf "%s %.6f\n", k, sum[k] / 1e6 }'
+}
+
+# Runs one configuration and appends a line to the output file.
+# The first argument is "preload" if links should be served by a
+# preload server.
+run() {
+  local mode=$1
+  local threads=$2
+  shift 2
+
+  local flags=$(echo "$*" | sed 's/-Wl,//g')
+  local best=
+  local trace=$dir/trace.json
+  local args="-Wl,--thread-count=$threads -Wl,-perf-trace=$trace $*"
+
+  # Once a server is running, links connect to it automatically.
+  if [ $mode = preload ]; then
+    flags="-preload${flags:+ $flags}"
+    link $args -Wl,-preload
+
+    # Give the server time to start listening.
+    sleep 1
+  fi
+
+  rm -f $dir/phases
+  for i in $(seq $RUNS); do
+    rm -f $trace
+    local start=$(now)
+    link $args
+    local real=$(elapsed $(now) $start)
+
+    if [ -z "$best" ] || awk -v a=$real -v b=$best 'BEGIN { exit !(a < b) }'; then
+      best=$real
+    fi
+
+    [ -f $trace ] && read_trace $trace >> $dir/phases
+  done
+
+  if [ $mode = preload ]; then
+    pkill -f -- "-o $dir/exe .*-preload" || true
+  fi
+
+  $dir/exe
+
+  {
+    printf '{"flags":"%s","threads":%d,"real":%.6f,"phases":{' \
+      "$flags" $threads $best
+    [ -f $dir/phases ] && sort -k1,1 -k2,2g $dir/phases | awk '
+      $1 != last { printf "%s\"%s\":%s", (NR > 1 ? "," : ""), $1, $2; last = $1 }'
+    printf '}}\n'
+  } >> $out
+
+  echo "$flags threads=$threads real=$best"
+}
+
+mkdir -p $dir
+rm -f $out
+
+for threads in $THREADS; do
+  run normal $threads
+  run normal $threads -Wl,--icf=all
+  run normal $threads -Wl,--gc-sections
+  run normal $threads -Wl,--build-id
+  run preload $threads
+done
+
+echo "Results are written to $out"
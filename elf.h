@@ -33,10 +33,13 @@ static constexpr u32 SHT_FINI_ARRAY = 15;
 static constexpr u32 SHT_PREINIT_ARRAY = 16;
 static constexpr u32 SHT_GROUP = 17;
 static constexpr u32 SHT_SYMTAB_SHNDX = 18;
+static constexpr u32 SHT_RELR = 19;
 static constexpr u32 SHT_GNU_HASH = 0x6ffffff6;
 static constexpr u32 SHT_GNU_VERDEF = 0x6ffffffd;
 static constexpr u32 SHT_GNU_VERNEED = 0x6ffffffe;
 static constexpr u32 SHT_GNU_VERSYM = 0x6fffffff;
+static constexpr u32 SHT_LLVM_ADDRSIG = 0x6fff4c03;
+static constexpr u32 SHT_LLVM_CALL_GRAPH_PROFILE = 0x6fff4c09;
 static constexpr u32 SHT_X86_64_UNWIND = 0x70000001;
 
 static constexpr u32 SHF_WRITE = 0x1;
@@ -53,6 +56,8 @@ static constexpr u32 SHF_EXCLUDE = 0x80000000;
 
 static constexpr u32 GRP_COMDAT = 1;
 
+static constexpr u32 ELFCOMPRESS_ZLIB = 1;
+
 static constexpr u32 STT_NOTYPE = 0;
 static constexpr u32 STT_OBJECT = 1;
 static constexpr u32 STT_FUNC = 2;
@@ -142,6 +147,9 @@ static constexpr u32 DT_INIT_ARRAYSZ = 27;
 static constexpr u32 DT_FINI_ARRAYSZ = 28;
 static constexpr u32 DT_RUNPATH = 29;
 static constexpr u32 DT_FLAGS = 30;
+static constexpr u32 DT_RELRSZ = 35;
+static constexpr u32 DT_RELR = 36;
+static constexpr u32 DT_RELRENT = 37;
 static constexpr u32 DT_GNU_HASH = 0x6ffffef5;
 static constexpr u32 DT_VERSYM = 0x6ffffff0;
 static constexpr u32 DT_RELACOUNT = 0x6ffffff9;
@@ -249,6 +257,13 @@ struct ElfShdr {
   u64 sh_entsize;
 };
 
+struct ElfChdr {
+  u32 ch_type;
+  u32 ch_reserved;
+  u64 ch_size;
+  u64 ch_addralign;
+};
+
 struct ElfEhdr {
   u8 e_ident[16];
   u16 e_type;
@@ -277,6 +292,12 @@ struct ElfPhdr {
   u64 p_align;
 };
 
+struct ElfRel {
+  u64 r_offset;
+  u32 r_type;
+  u32 r_sym;
+};
+
 struct ElfRela {
   u64 r_offset;
   u32 r_type;
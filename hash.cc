@@ -0,0 +1,124 @@
+// This file implements a streaming version of MurmurHash3_x64_128,
+// a fast non-cryptographic 128-bit hash function. It is used where we
+// need a wide, well-distributed hash value but don't need resistance
+// against intentional collisions, e.g. for identical code folding.
+//
+// The result is the same as the reference implementation's
+// MurmurHash3_x64_128() applied to the concatenation of all inputs.
+
+#include "mold.h"
+
+#include <cstring>
+
+static inline u64 rotl(u64 x, i64 r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 fmix(u64 k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccd;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53;
+  k ^= k >> 33;
+  return k;
+}
+
+static constexpr u64 C1 = 0x87c37b91114253d5;
+static constexpr u64 C2 = 0x4cf5ad432745937f;
+
+inline void Hash128::mix(const u8 *block) {
+  u64 k1 = *(u64 *)block;
+  u64 k2 = *(u64 *)(block + 8);
+
+  k1 *= C1;
+  k1 = rotl(k1, 31);
+  k1 *= C2;
+  h1 ^= k1;
+
+  h1 = rotl(h1, 27);
+  h1 += h2;
+  h1 = h1 * 5 + 0x52dce729;
+
+  k2 *= C2;
+  k2 = rotl(k2, 33);
+  k2 *= C1;
+  h2 ^= k2;
+
+  h2 = rotl(h2, 31);
+  h2 += h1;
+  h2 = h2 * 5 + 0x38495ab5;
+}
+
+void Hash128::update(const void *data, i64 size) {
+  const u8 *p = (const u8 *)data;
+  len += size;
+
+  // Fill a partial block first
+  if (buf_size) {
+    i64 n = std::min<i64>(size, BLOCK_SIZE - buf_size);
+    memcpy(buf + buf_size, p, n);
+    buf_size += n;
+    p += n;
+    size -= n;
+
+    if (buf_size < BLOCK_SIZE)
+      return;
+    mix(buf);
+    buf_size = 0;
+  }
+
+  for (; size >= BLOCK_SIZE; p += BLOCK_SIZE, size -= BLOCK_SIZE)
+    mix(p);
+
+  memcpy(buf, p, size);
+  buf_size = size;
+}
+
+void Hash128::finish(u8 *out) {
+  u64 k1 = 0;
+  u64 k2 = 0;
+
+  switch (buf_size) {
+  case 15: k2 ^= (u64)buf[14] << 48; [[fallthrough]];
+  case 14: k2 ^= (u64)buf[13] << 40; [[fallthrough]];
+  case 13: k2 ^= (u64)buf[12] << 32; [[fallthrough]];
+  case 12: k2 ^= (u64)buf[11] << 24; [[fallthrough]];
+  case 11: k2 ^= (u64)buf[10] << 16; [[fallthrough]];
+  case 10: k2 ^= (u64)buf[9] << 8;   [[fallthrough]];
+  case 9:
+    k2 ^= (u64)buf[8];
+    k2 *= C2;
+    k2 = rotl(k2, 33);
+    k2 *= C1;
+    h2 ^= k2;
+    [[fallthrough]];
+  case 8: k1 ^= (u64)buf[7] << 56; [[fallthrough]];
+  case 7: k1 ^= (u64)buf[6] << 48; [[fallthrough]];
+  case 6: k1 ^= (u64)buf[5] << 40; [[fallthrough]];
+  case 5: k1 ^= (u64)buf[4] << 32; [[fallthrough]];
+  case 4: k1 ^= (u64)buf[3] << 24; [[fallthrough]];
+  case 3: k1 ^= (u64)buf[2] << 16; [[fallthrough]];
+  case 2: k1 ^= (u64)buf[1] << 8;  [[fallthrough]];
+  case 1:
+    k1 ^= (u64)buf[0];
+    k1 *= C1;
+    k1 = rotl(k1, 31);
+    k1 *= C2;
+    h1 ^= k1;
+  }
+
+  h1 ^= len;
+  h2 ^= len;
+
+  h1 += h2;
+  h2 += h1;
+
+  h1 = fmix(h1);
+  h2 = fmix(h2);
+
+  h1 += h2;
+  h2 += h1;
+
+  memcpy(out, &h1, 8);
+  memcpy(out + 8, &h2, 8);
+}
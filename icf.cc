@@ -11,39 +11,84 @@ static constexpr i64 HASH_SIZE = 16;
 
 typedef std::array<u8, HASH_SIZE> Digest;
 
+// .eh_frame is not an ordinary input section, so a section referring
+// to it directly (e.g. crtbegin's .text) can't be compared with others.
+static bool refers_to_ehframe(InputSection &isec) {
+  for (i64 i = 0; i < isec.rels.size(); i++) {
+    if (isec.has_fragments[i])
+      continue;
+    Symbol &sym = *isec.file->symbols[isec.rels[i].r_sym];
+    if (!sym.frag && sym.input_section && sym.input_section->is_ehframe)
+      return true;
+  }
+  return false;
+}
+
+// Read-only data such as constants and vtables is eligible for ICF
+// as well as code.
 static bool is_eligible(InputSection &isec) {
   bool is_alloc = (isec.shdr.sh_flags & SHF_ALLOC);
   bool is_executable = (isec.shdr.sh_flags & SHF_EXECINSTR);
   bool is_writable = (isec.shdr.sh_flags & SHF_WRITE);
-  bool is_bss = (isec.shdr.sh_type == SHT_NOBITS);
+  bool is_progbits = (isec.shdr.sh_type == SHT_PROGBITS);
   bool is_init = (isec.shdr.sh_type == SHT_INIT_ARRAY || isec.name == ".init");
   bool is_fini = (isec.shdr.sh_type == SHT_FINI_ARRAY || isec.name == ".fini");
   bool is_enumerable = is_c_identifier(isec.name);
 
-  return is_alloc && is_executable && !is_writable && !is_bss &&
-         !is_init && !is_fini && !is_enumerable;
+  return is_alloc && (is_executable || is_progbits) && !is_writable &&
+         !is_init && !is_fini && !is_enumerable && !isec.is_addrsig &&
+         !refers_to_ehframe(isec);
 }
 
-static Digest digest_final(SHA256_CTX &ctx) {
-  u8 digest[SHA256_SIZE];
-  assert(SHA256_Final(digest, &ctx) == 1);
+// Digests are computed by one of the following hashers. The fast
+// one is the default; SHA-256 can be selected with --icf-hash=sha256
+// for stronger collision resistance. Either way, it's truncated to
+// HASH_SIZE bytes.
+class FastHasher {
+public:
+  void update(const void *data, i64 size) { hash.update(data, size); }
+
+  Digest finish() {
+    Digest arr;
+    hash.finish(arr.data());
+    return arr;
+  }
 
-  Digest arr;
-  memcpy(arr.data(), digest, HASH_SIZE);
-  return arr;
-}
+private:
+  static_assert(Hash128::HASH_SIZE == HASH_SIZE);
+  Hash128 hash;
+};
 
-static Digest compute_digest(InputSection &isec) {
+class Sha256Hasher {
+public:
+  Sha256Hasher() { SHA256_Init(&ctx); }
+
+  void update(const void *data, i64 size) { SHA256_Update(&ctx, data, size); }
+
+  Digest finish() {
+    u8 digest[SHA256_SIZE];
+    assert(SHA256_Final(digest, &ctx) == 1);
+
+    Digest arr;
+    memcpy(arr.data(), digest, HASH_SIZE);
+    return arr;
+  }
+
+private:
   SHA256_CTX ctx;
-  SHA256_Init(&ctx);
+};
+
+template <typename Hasher>
+static Digest compute_digest(InputSection &isec) {
+  Hasher hasher;
 
   auto hash_i64 = [&](i64 val) {
-    SHA256_Update(&ctx, &val, 8);
+    hasher.update(&val, 8);
   };
 
   auto hash_string = [&](std::string_view str) {
     hash_i64(str.size());
-    SHA256_Update(&ctx, str.data(), str.size());
+    hasher.update(str.data(), str.size());
   };
 
   auto hash_symbol = [&](Symbol &sym) {
@@ -96,7 +141,7 @@ static Digest compute_digest(InputSection &isec) {
     }
   }
 
-  return digest_final(ctx);
+  return hasher.finish();
 }
 
 static Digest pack_number(i64 val) {
@@ -106,6 +151,7 @@ static Digest pack_number(i64 val) {
   return arr;
 }
 
+template <typename Hasher>
 static void gather_sections(std::vector<Digest> &digests,
                             std::vector<InputSection *> &sections,
                             std::vector<u32> &edge_indices,
@@ -148,14 +194,14 @@ static void gather_sections(std::vector<Digest> &digests,
       ent.isec = isec;
       ent.is_eligible = is_eligible(*isec);
       ent.digest =
-        ent.is_eligible ? compute_digest(*isec) : pack_number((i << 32) | j);
+        ent.is_eligible ? compute_digest<Hasher>(*isec) : pack_number((i << 32) | j);
       if (ent.is_eligible)
         num_eligibles.local() += 1;
     }
   });
 
   // Sort `entries` so that all eligible sections precede non-eligible sections.
-  // Eligible sections are sorted by SHA hash.
+  // Eligible sections are sorted by digest.
   tbb::parallel_sort(entries.begin(), entries.end(),
                      [](const Entry &a, const Entry &b) {
                        if (!a.is_eligible || !b.is_eligible)
@@ -217,92 +263,195 @@ static void gather_sections(std::vector<Digest> &digests,
   });
 }
 
-void icf_sections() {
-  Timer t("icf");
+// Build a reverse-edge index for eligible sections, so that we can
+// find sections that refer to a given section.
+static void reverse_edges(i64 num_sections,
+                          std::vector<u32> &edge_indices,
+                          std::vector<u32> &edges,
+                          std::vector<u32> &rev_edge_indices,
+                          std::vector<u32> &rev_edges) {
+  Timer t("reverse_edges");
+
+  std::vector<std::atomic<u32>> num_rev_edges(num_sections);
+
+  tbb::parallel_for((i64)0, (i64)edges.size(), [&](i64 i) {
+    if (edges[i] < num_sections)
+      num_rev_edges[edges[i]]++;
+  });
+
+  rev_edge_indices.resize(num_sections + 1);
+  for (i64 i = 0; i < num_sections; i++)
+    rev_edge_indices[i + 1] = rev_edge_indices[i] + num_rev_edges[i];
+
+  rev_edges.resize(rev_edge_indices.back());
+
+  tbb::parallel_for((i64)0, num_sections, [&](i64 i) {
+    i64 end = (i + 1 == num_sections) ? edges.size() : edge_indices[i + 1];
+    for (i64 j = edge_indices[i]; j < end; j++)
+      if (u32 target = edges[j]; target < num_sections)
+        rev_edges[rev_edge_indices[target] + --num_rev_edges[target]] = i;
+  });
+}
 
+// ICF partitions eligible sections into equivalence classes. Initially,
+// sections are grouped by their contents' digests. In each round, a
+// class is split if its members refer to sections in different classes.
+// We repeat until no class is split.
+//
+// Equivalence classes are kept as contiguous ranges in `order`, and a
+// class is identified by the position of its first member in `order`.
+// When a class is split, one part keeps the ID and the others get new
+// IDs, so only sections that refer to sections whose class ID changed
+// need to be revisited in the next round.
+template <typename Hasher>
+static void do_icf_sections() {
   // Prepare for the propagation rounds.
-  std::vector<Digest> digests0;
+  std::vector<Digest> digests;
   std::vector<InputSection *> sections;
   std::vector<u32> edge_indices;
   std::vector<u32> edges;
 
-  gather_sections(digests0, sections, edge_indices, edges);
+  gather_sections<Hasher>(digests, sections, edge_indices, edges);
 
-  std::vector<std::vector<Digest>> digests(2);
-  digests[0] = std::move(digests0);
-  digests[1] = digests[0];
+  i64 num_sections = sections.size();
 
-  i64 slot = 0;
+  std::vector<u32> rev_edge_indices;
+  std::vector<u32> rev_edges;
+  reverse_edges(num_sections, edge_indices, edges, rev_edge_indices, rev_edges);
 
-  auto count_num_classes = [&]() {
-    tbb::enumerable_thread_specific<i64> num_classes;
-    tbb::parallel_for((i64)0, (i64)sections.size() - 1, [&](i64 i) {
-      if (digests[slot][i] != digests[slot][i + 1])
-        num_classes.local()++;
-    });
-    return num_classes.combine(std::plus());
-  };
+  // Non-eligible sections are all different from each other,
+  // so their class IDs are just their indices.
+  std::vector<u32> order(num_sections);
+  std::vector<u32> class_id(digests.size());
+  std::vector<u32> class_end(num_sections);
+
+  for (i64 i = 0; i < digests.size(); i++) {
+    if (i < num_sections) {
+      order[i] = i;
+      class_id[i] = (i > 0 && digests[i - 1] == digests[i]) ? class_id[i - 1] : i;
+      class_end[class_id[i]] = i + 1;
+    } else {
+      class_id[i] = i;
+    }
+  }
 
-  i64 num_classes = count_num_classes();
-  // SyncOut() << "num_classes=" << num_classes;
+  auto is_singleton = [&](u32 i) {
+    return class_end[class_id[i]] == class_id[i] + 1;
+  };
 
   Timer t2("propagate");
   static Counter round("icf_round");
+  static Counter rehashed("icf_rehashed");
+
+  // A section's signature is a digest of its contents and the
+  // class IDs of the sections it refers to.
+  std::vector<Digest> sigs(num_sections);
+  std::vector<std::atomic_bool> on_worklist(num_sections);
+  std::vector<std::atomic_bool> is_affected(num_sections);
+
+  std::vector<u32> worklist;
+  for (i64 i = 0; i < num_sections; i++)
+    if (!is_singleton(i))
+      worklist.push_back(i);
 
   // Execute the propagation rounds until convergence is obtained.
-  for (;;) {
+  while (!worklist.empty()) {
     round.inc();
+    rehashed.inc(worklist.size());
+
+    tbb::enumerable_thread_specific<std::vector<u32>> affected;
+
+    tbb::parallel_for_each(worklist, [&](u32 i) {
+      on_worklist[i] = false;
 
-    tbb::parallel_for((i64)0, (i64)sections.size(), [&](i64 i) {
-      SHA256_CTX ctx;
-      SHA256_Init(&ctx);
-      SHA256_Update(&ctx, digests[slot][i].data(), HASH_SIZE);
+      Hasher hasher;
+      hasher.update(digests[i].data(), HASH_SIZE);
 
       i64 begin = edge_indices[i];
-      i64 end = (i + 1 == sections.size()) ? edges.size() : edge_indices[i + 1];
+      i64 end = (i + 1 == num_sections) ? edges.size() : edge_indices[i + 1];
       for (i64 j = begin; j < end; j++)
-        SHA256_Update(&ctx, digests[slot][edges[j]].data(), HASH_SIZE);
+        hasher.update(&class_id[edges[j]], sizeof(u32));
+      sigs[i] = hasher.finish();
 
-      digests[slot ^ 1][i] = digest_final(ctx);
+      if (!is_affected[class_id[i]].exchange(true))
+        affected.local().push_back(class_id[i]);
     });
 
-    slot ^= 1;
+    // Split affected classes by signature. Sections not on the
+    // worklist keep their signatures from earlier rounds, which are
+    // still valid because the classes they refer to haven't changed.
+    tbb::enumerable_thread_specific<std::vector<u32>> changed;
+
+    tbb::parallel_for_each(affected, [&](std::vector<u32> &vec) {
+      tbb::parallel_for_each(vec, [&](u32 begin) {
+        is_affected[begin] = false;
+        u32 end = class_end[begin];
+
+        std::sort(order.begin() + begin, order.begin() + end, [&](u32 a, u32 b) {
+          return std::tuple(sigs[a], a) < std::tuple(sigs[b], b);
+        });
+
+        u32 start = begin;
+        for (u32 i = begin + 1; i <= end; i++) {
+          if (i < end && sigs[order[i - 1]] == sigs[order[i]])
+            continue;
+
+          class_end[start] = i;
+          if (start != begin) {
+            for (u32 j = start; j < i; j++) {
+              class_id[order[j]] = start;
+              changed.local().push_back(order[j]);
+            }
+          }
+          start = i;
+        }
+      });
+    });
 
-    i64 n = count_num_classes();
-    // SyncOut() << "num_classes=" << n;
-    if (n == num_classes)
-      break;
-    num_classes = n;
+    // Sections that refer to sections whose class ID has changed need
+    // to be revisited.
+    tbb::enumerable_thread_specific<std::vector<u32>> next;
+
+    tbb::parallel_for_each(changed, [&](std::vector<u32> &vec) {
+      for (u32 i : vec)
+        for (i64 j = rev_edge_indices[i]; j < rev_edge_indices[i + 1]; j++)
+          if (u32 pred = rev_edges[j];
+              !is_singleton(pred) && !on_worklist[pred].exchange(true))
+            next.local().push_back(pred);
+    });
+
+    worklist.clear();
+    for (std::vector<u32> &vec : next)
+      append(worklist, vec);
   }
   t2.stop();
 
-
-  // Group sections by SHA1 digest.
+  // Group sections by class.
   Timer t3("merge");
 
   struct Entry {
     InputSection *isec;
-    Digest digest;
+    u32 class_id;
   };
 
   std::vector<Entry> entries;
   entries.resize(sections.size());
 
   tbb::parallel_for((i64)0, (i64)sections.size(), [&](i64 i) {
-    entries[i] = {sections[i], digests[slot][i]};
+    entries[i] = {sections[i], class_id[i]};
   });
 
   tbb::parallel_sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
-    if (a.digest != b.digest)
-      return a.digest < b.digest;
+    if (a.class_id != b.class_id)
+      return a.class_id < b.class_id;
     return a.isec->get_priority() < b.isec->get_priority();
   });
 
   tbb::parallel_for((i64)0, (i64)entries.size() - 1, [&](i64 i) {
-    if (i == 0 || entries[i - 1].digest != entries[i].digest) {
+    if (i == 0 || entries[i - 1].class_id != entries[i].class_id) {
       InputSection *leader = entries[i].isec;
       i64 j = i + 1;
-      while (j < entries.size() && entries[i].digest == entries[j].digest)
+      while (j < entries.size() && entries[i].class_id == entries[j].class_id)
         entries[j++].isec->leader = leader;
     }
   });
@@ -340,3 +489,63 @@ void icf_sections() {
     SyncOut() << "ICF saved " << saved_bytes << " bytes";
   }
 }
+
+static u64 read_uleb(std::string_view &data) {
+  u64 val = 0;
+  for (i64 shift = 0; !data.empty(); shift += 7) {
+    u8 byte = data[0];
+    data = data.substr(1);
+    val |= (u64)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      break;
+  }
+  return val;
+}
+
+// In --icf=safe mode, sections whose addresses may be compared must
+// not be merged. Compilers list the symbols whose addresses are taken
+// in .llvm_addrsig. If a file doesn't have the section, we have to
+// assume that all symbols it refers to are address-significant.
+static void mark_addrsig_sections() {
+  Timer t("mark_addrsig");
+
+  auto mark = [](Symbol *sym) {
+    if (sym->input_section)
+      sym->input_section->is_addrsig = true;
+  };
+
+  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
+    if (!file->addrsig_sec) {
+      for (Symbol *sym : file->symbols)
+        mark(sym);
+      return;
+    }
+
+    std::string_view data = file->get_string(*file->addrsig_sec);
+    while (!data.empty()) {
+      u64 idx = read_uleb(data);
+      if (idx >= file->symbols.size())
+        Fatal() << *file << ": .llvm_addrsig: invalid symbol index";
+      mark(file->symbols[idx]);
+    }
+
+    // Exported symbols can be compared by other modules.
+    if (config.export_dynamic)
+      for (i64 i = file->first_global; i < file->symbols.size(); i++)
+        if (Symbol *sym = file->symbols[i];
+            sym->file == file && sym->esym->st_visibility == STV_DEFAULT)
+          mark(sym);
+  });
+}
+
+void icf_sections() {
+  Timer t("icf");
+
+  if (!config.icf_all)
+    mark_addrsig_sections();
+
+  if (config.icf_hash == IcfHashKind::SHA256)
+    do_icf_sections<Sha256Hasher>();
+  else
+    do_icf_sections<FastHasher>();
+}
@@ -0,0 +1,317 @@
+// This file implements --incremental.
+//
+// In the incremental mode, we write a state file next to the output
+// file after each successful link. It records the command line, the
+// output file's size and mtime, and, for each input object file, its
+// identity (name, size and mtime) as well as the file offset of each of
+// its sections and how many bytes were reserved for it.
+//
+// On the next link, we reserve the same amount of space for each input
+// section as before. As long as no section outgrows its reservation and
+// the set of input files stays the same, sections of unchanged files
+// land on the same file offsets as in the previous output. For such
+// sections, we don't copy section contents again but only re-apply
+// their relocations in place, since relocation targets may have moved.
+// Everything else, i.e. sections of changed files, sections that moved
+// and all linker-synthesized sections, is written as usual.
+//
+// If none of the sections can be reused, this is just a regular full
+// link that writes a new state file for the next time.
+
+#include "mold.h"
+
+#include <cstring>
+#include <sys/stat.h>
+#include <tbb/parallel_for.h>
+#include <unistd.h>
+#include <unordered_map>
+
+static constexpr char MAGIC[8] = {'M', 'O', 'L', 'D', 'I', 'N', 'C', '1'};
+
+struct SectionState {
+  u64 offset = -1;
+  u32 reserved = 0;
+};
+
+struct FileState {
+  u64 size = 0;
+  i64 mtime = 0;
+  std::vector<SectionState> sections;
+};
+
+// Files and their keys as of prepare_incremental_link().
+static std::vector<ObjectFile *> files;
+static std::vector<std::string> keys;
+static std::vector<u8> is_unchanged;
+
+static std::string cmdline;
+static std::unordered_map<std::string, FileState> prev_files;
+
+static std::string get_state_path() {
+  return config.output + ".mold-state";
+}
+
+static i64 get_mtime(const struct stat &st) {
+  return (i64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Sections get some extra room at the end so that they can grow a bit
+// without moving the following sections. We can't do that for sections
+// whose contents are concatenated to form a single entity such as
+// .init or .init_array, or for non-alloc sections such as .debug_info
+// whose consumers don't expect gaps.
+static bool can_have_slack(InputSection &isec) {
+  return (isec.shdr.sh_flags & SHF_ALLOC) &&
+         isec.shdr.sh_type != SHT_NOTE &&
+         isec.shdr.sh_type != SHT_INIT_ARRAY &&
+         isec.shdr.sh_type != SHT_FINI_ARRAY &&
+         isec.shdr.sh_type != SHT_PREINIT_ARRAY &&
+         !isec.name.starts_with(".ctors") &&
+         !isec.name.starts_with(".dtors") &&
+         !isec.name.starts_with(".init") &&
+         !isec.name.starts_with(".fini") &&
+         !is_c_identifier(isec.name);
+}
+
+static u32 get_default_slack(InputSection &isec) {
+  if (!can_have_slack(isec) || isec.shdr.sh_size == 0)
+    return 0;
+  return isec.shdr.sh_size / 8 + 16;
+}
+
+static u64 get_file_offset(InputSection &isec) {
+  if (!isec.is_alive || !isec.output_section)
+    return -1;
+  return isec.output_section->shdr.sh_offset + isec.offset;
+}
+
+// The same archive member can appear more than once on the command
+// line, so we append an occurrence count to make keys unique.
+static void compute_keys() {
+  std::unordered_map<std::string, i64> count;
+
+  for (ObjectFile *file : files) {
+    std::string key = file->archive_name.empty()
+      ? file->name : file->archive_name + "(" + file->name + ")";
+    key += "#" + std::to_string(count[key]++);
+    keys.push_back(key);
+  }
+}
+
+class StateReader {
+public:
+  StateReader(std::string_view data) : data(data) {}
+
+  u64 read_u64() {
+    if (data.size() < 8) {
+      ok = false;
+      return 0;
+    }
+    u64 val = *(u64 *)data.data();
+    data = data.substr(8);
+    return val;
+  }
+
+  std::string read_string() {
+    u64 len = read_u64();
+    if (data.size() < len) {
+      ok = false;
+      return "";
+    }
+    std::string str(data.substr(0, len));
+    data = data.substr(len);
+    return str;
+  }
+
+  std::string_view data;
+  bool ok = true;
+};
+
+static void write_u64(std::string &buf, u64 val) {
+  buf.append((char *)&val, 8);
+}
+
+static void write_string(std::string &buf, std::string_view str) {
+  write_u64(buf, str.size());
+  buf.append(str);
+}
+
+// Reads a state file. Returns false if it does not exist, is broken
+// or was written for a different command line or output file.
+static bool read_state() {
+  MemoryMappedFile *mb = MemoryMappedFile::open(get_state_path());
+  if (!mb)
+    return false;
+
+  std::string_view data = mb->get_contents();
+  if (!data.starts_with(std::string_view(MAGIC, sizeof(MAGIC))))
+    return false;
+
+  StateReader r(data.substr(sizeof(MAGIC)));
+  if (r.read_string() != cmdline)
+    return false;
+
+  u64 output_size = r.read_u64();
+  i64 output_mtime = r.read_u64();
+
+  // The output file must be exactly what we wrote last time.
+  struct stat st;
+  if (stat(config.output.c_str(), &st) == -1 || (st.st_mode & S_IFMT) != S_IFREG ||
+      st.st_size != output_size || get_mtime(st) != output_mtime)
+    return false;
+
+  u64 num_files = r.read_u64();
+  for (i64 i = 0; i < num_files && r.ok; i++) {
+    std::string key = r.read_string();
+    FileState state;
+    state.size = r.read_u64();
+    state.mtime = r.read_u64();
+    state.sections.resize(r.read_u64());
+    for (SectionState &sec : state.sections) {
+      sec.offset = r.read_u64();
+      sec.reserved = r.read_u64();
+    }
+    prev_files[key] = std::move(state);
+  }
+  return r.ok;
+}
+
+// This function is called after input sections are binned to output
+// sections. It sets the amount of slack for each input section, and
+// finds files that haven't changed since the last link.
+void prepare_incremental_link(std::span<std::string_view> args) {
+  Timer t("incremental");
+
+  for (std::string_view arg : args)
+    cmdline += std::string(arg) + "\n";
+
+  files = out::objs;
+  compute_keys();
+  is_unchanged.resize(files.size());
+
+  if (!read_state())
+    prev_files.clear();
+
+  // We are going to overwrite the output file. If we fail in the
+  // middle of linking, the next link should not trust it.
+  unlink(get_state_path().c_str());
+
+  tbb::parallel_for((i64)0, (i64)files.size(), [&](i64 i) {
+    ObjectFile *file = files[i];
+    auto it = prev_files.find(keys[i]);
+
+    if (it == prev_files.end() ||
+        it->second.sections.size() != file->sections.size()) {
+      for (InputSection *isec : file->sections)
+        if (isec)
+          isec->slack = get_default_slack(*isec);
+      return;
+    }
+
+    const FileState &prev = it->second;
+    for (i64 j = 0; j < file->sections.size(); j++) {
+      if (InputSection *isec = file->sections[j]) {
+        if (can_have_slack(*isec) && isec->shdr.sh_size <= prev.sections[j].reserved)
+          isec->slack = prev.sections[j].reserved - isec->shdr.sh_size;
+        else
+          isec->slack = get_default_slack(*isec);
+      }
+    }
+
+    is_unchanged[i] = (prev.size == file->mb->size() &&
+                       prev.mtime == file->mb->mtime);
+  });
+}
+
+// Relocations for TLS relaxation rewrite instructions, and whether
+// they are relaxed or not depends on other files. We can't tell if
+// the previous output contains rewritten instructions for them.
+static bool has_tls_relaxation(InputSection &isec) {
+  for (RelType type : isec.rel_types)
+    if (type == R_TLSGD || type == R_TLSGD_RELAX_LE ||
+        type == R_TLSLD || type == R_TLSLD_RELAX_LE)
+      return true;
+  return false;
+}
+
+// This function is called after the output file is opened. It decides
+// which sections can be left as-is in the output file.
+void reuse_previous_output(OutputFile *file) {
+  Timer t("incremental");
+  static Counter reused("incremental_reused_sections");
+
+  if (!file->has_old_contents)
+    return;
+
+  tbb::parallel_for((i64)0, (i64)files.size(), [&](i64 i) {
+    if (!is_unchanged[i])
+      return;
+
+    ObjectFile *obj = files[i];
+    const FileState &prev = prev_files.at(keys[i]);
+
+    for (i64 j = 0; j < obj->sections.size(); j++) {
+      InputSection *isec = obj->sections[j];
+      if (isec && get_file_offset(*isec) != -1 &&
+          get_file_offset(*isec) == prev.sections[j].offset &&
+          isec->shdr.sh_size + isec->slack == prev.sections[j].reserved &&
+          !has_tls_relaxation(*isec)) {
+        isec->is_unchanged = true;
+        reused.inc();
+      }
+    }
+  });
+}
+
+// Writes a new state file after the output file is closed.
+void write_incremental_state(i64 filesize) {
+  Timer t("incremental");
+
+  struct stat st;
+  if (stat(config.output.c_str(), &st) == -1 || (st.st_mode & S_IFMT) != S_IFREG)
+    return;
+
+  std::string buf(MAGIC, sizeof(MAGIC));
+  write_string(buf, cmdline);
+  write_u64(buf, filesize);
+  write_u64(buf, get_mtime(st));
+  write_u64(buf, files.size());
+
+  for (i64 i = 0; i < files.size(); i++) {
+    ObjectFile *file = files[i];
+    write_string(buf, keys[i]);
+    write_u64(buf, file->mb->size());
+    write_u64(buf, file->mb->mtime);
+    write_u64(buf, file->sections.size());
+
+    for (InputSection *isec : file->sections) {
+      if (isec) {
+        write_u64(buf, get_file_offset(*isec));
+        write_u64(buf, isec->shdr.sh_size + isec->slack);
+      } else {
+        write_u64(buf, -1);
+        write_u64(buf, 0);
+      }
+    }
+  }
+
+  std::string path = get_state_path();
+  std::string tmp = path + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "w");
+  if (!fp) {
+    Error() << "cannot open " << tmp << ": " << strerror(errno);
+    return;
+  }
+
+  // Don't replace the previous state with a truncated one.
+  bool ok = (fwrite(buf.data(), 1, buf.size(), fp) == buf.size());
+  ok = (fclose(fp) == 0) && ok;
+  if (!ok) {
+    Error() << tmp << ": write failed: " << strerror(errno);
+    unlink(tmp.c_str());
+    return;
+  }
+
+  if (rename(tmp.c_str(), path.c_str()) == -1)
+    Error() << path << ": rename failed: " << strerror(errno);
+}
@@ -1,6 +1,9 @@
 #include "mold.h"
 
+#include <immintrin.h>
 #include <limits>
+#include <tbb/parallel_for.h>
+#include <zlib.h>
 
 InputChunk::InputChunk(ObjectFile *file, const ElfShdr &shdr,
                        std::string_view name)
@@ -8,12 +11,29 @@ InputChunk::InputChunk(ObjectFile *file, const ElfShdr &shdr,
     output_section(OutputSection::get_instance(name, shdr.sh_type, shdr.sh_flags)) {}
 
 std::string_view InputChunk::get_contents() const {
-  return file->get_string(shdr);
+  if (compressed.empty())
+    return file->get_string(shdr);
+
+  // Decompress into the calling thread's arena. This is called for
+  // mergeable sections while parsing files and for the other sections
+  // while copying them to the output file, both of which run in parallel.
+  std::call_once(decompress_once, [&] {
+    u8 *buf = (u8 *)Arena::alloc(shdr.sh_size, 1);
+    uLongf size = shdr.sh_size;
+    if (uncompress(buf, &size, (u8 *)compressed.data(), compressed.size()) != Z_OK ||
+        size != shdr.sh_size)
+      Fatal() << *this << ": uncompress failed";
+    decompressed = {(char *)buf, (size_t)size};
+
+    static Counter counter("decompressed_bytes");
+    counter.inc(size);
+  });
+  return decompressed;
 }
 
 i64 InputChunk::get_section_idx() const {
   assert(&file->elf_sections.front() <= &shdr &&
-         &shdr < &file->elf_sections.back());
+         &shdr <= &file->elf_sections.back());
   return &shdr - &file->elf_sections.front();
 }
 
@@ -149,13 +169,30 @@ static void write_val(u64 r_type, u8 *loc, u64 val) {
 }
 
 void InputSection::copy_buf() {
+  write_to(out::buf + output_section->shdr.sh_offset + offset);
+}
+
+void InputSection::write_to(u8 *base) {
   if (shdr.sh_type == SHT_NOBITS || shdr.sh_size == 0)
     return;
 
-  // Copy data
-  u8 *base = out::buf + output_section->shdr.sh_offset + offset;
-  std::string_view contents = get_contents();
-  memcpy(base, contents.data(), contents.size());
+  // Copy data unless the output file already has them
+  if (!is_unchanged) {
+    std::string_view contents = get_contents();
+
+    // A huge section such as .debug_info would otherwise be a serial
+    // tail of the copy phase.
+    static constexpr i64 CHUNK_SIZE = 4 * 1024 * 1024;
+    if (contents.size() <= CHUNK_SIZE) {
+      memcpy(base, contents.data(), contents.size());
+    } else {
+      i64 num_chunks = (contents.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+      tbb::parallel_for((i64)0, num_chunks, [&](i64 i) {
+        i64 size = std::min<i64>(CHUNK_SIZE, contents.size() - i * CHUNK_SIZE);
+        memcpy(base + i * CHUNK_SIZE, contents.data() + i * CHUNK_SIZE, size);
+      });
+    }
+  }
 
   // Apply relocations
   if (shdr.sh_flags & SHF_ALLOC)
@@ -168,6 +205,42 @@ void InputSection::copy_buf() {
 // mapped to memory at runtime) based on the result of
 // scan_relocations().
 void InputSection::apply_reloc_alloc(u8 *base) {
+  u64 sec_addr = output_section->shdr.sh_addr + offset;
+
+  auto get_sym_addr = [&](Symbol &sym) {
+    return (sym.get_plt_idx() == -1) ? sym.get_addr() : sym.get_plt_addr();
+  };
+
+  // Apply 32-bit PC-relative relocations. Overflows are rare, so we
+  // check them all at once and report them afterwards.
+  std::span<u32> pc32 = rel_plan.subspan(0, num_pc32_rels);
+  bool overflow = false;
+
+  for (u32 i : pc32) {
+    const ElfRela &rel = rels[i];
+    i64 val = get_sym_addr(*file->symbols[rel.r_sym]) + rel.r_addend -
+              (sec_addr + rel.r_offset);
+    overflow |= (val != (i32)val);
+    *(u32 *)(base + rel.r_offset) = val;
+  }
+
+  if (overflow) {
+    for (u32 i : pc32) {
+      const ElfRela &rel = rels[i];
+      Symbol &sym = *file->symbols[rel.r_sym];
+      u64 val = get_sym_addr(sym) + rel.r_addend - (sec_addr + rel.r_offset);
+      overflow_check(this, sym, rel.r_type, val);
+    }
+  }
+
+  // Apply 64-bit absolute relocations. They never overflow.
+  for (u32 i : rel_plan.subspan(num_pc32_rels, num_abs64_rels)) {
+    const ElfRela &rel = rels[i];
+    *(u64 *)(base + rel.r_offset) =
+      get_sym_addr(*file->symbols[rel.r_sym]) + rel.r_addend;
+  }
+
+  // Apply the other relocations.
   i64 ref_idx = 0;
   ElfRela *dynrel = nullptr;
 
@@ -175,7 +248,7 @@ void InputSection::apply_reloc_alloc(u8 *base) {
     dynrel = (ElfRela *)(out::buf + out::reldyn->shdr.sh_offset +
                          file->reldyn_offset + reldyn_offset);
 
-  for (i64 i = 0; i < rels.size(); i++) {
+  for (u32 i : rel_plan.subspan(num_pc32_rels + num_abs64_rels)) {
     const ElfRela &rel = rels[i];
     Symbol &sym = *file->symbols[rel.r_sym];
     u8 *loc = base + rel.r_offset;
@@ -190,9 +263,9 @@ void InputSection::apply_reloc_alloc(u8 *base) {
     };
 
 #define S   (ref ? ref->frag->get_addr() \
-             : (sym.plt_idx == -1 ? sym.get_addr() : sym.get_plt_addr()))
+             : (sym.get_plt_idx() == -1 ? sym.get_addr() : sym.get_plt_addr()))
 #define A   (ref ? ref->addend : rel.r_addend)
-#define P   (output_section->shdr.sh_addr + offset + rel.r_offset)
+#define P   (sec_addr + rel.r_offset)
 #define G   (sym.get_got_addr() - out::got->shdr.sh_addr)
 #define GOT out::got->shdr.sh_addr
 
@@ -206,8 +279,11 @@ void InputSection::apply_reloc_alloc(u8 *base) {
       write(S + A);
       *dynrel++ = {P, R_X86_64_RELATIVE, 0, (i64)(S + A)};
       break;
+    case R_ABS_RELR:
+      write(S + A);
+      break;
     case R_DYN:
-      *dynrel++ = {P, R_X86_64_64, sym.dynsym_idx, A};
+      *dynrel++ = {P, R_X86_64_64, sym.get_dynsym_idx(), A};
       break;
     case R_PC:
       write(S + A - P);
@@ -232,7 +308,6 @@ void InputSection::apply_reloc_alloc(u8 *base) {
       };
       memcpy(loc - 4, insn, sizeof(insn));
       *(u32 *)(loc + 8) = S - out::tls_end + A + 4;
-      i++;
       break;
     }
     case R_TLSLD:
@@ -245,7 +320,6 @@ void InputSection::apply_reloc_alloc(u8 *base) {
         0x66, 0x66, 0x66, 0x64, 0x48, 0x8b, 0x04, 0x25, 0, 0, 0, 0,
       };
       memcpy(loc - 3, insn, sizeof(insn));
-      i++;
       break;
     }
     case R_DTPOFF:
@@ -285,10 +359,59 @@ void InputSection::apply_reloc_nonalloc(u8 *base) {
   static Counter counter("reloc_nonalloc");
   counter.inc(rels.size());
 
-  i64 ref_idx = 0;
+  // A single .debug_info section can have millions of relocations.
+  // We split such section into chunks and process them in parallel.
+  // Each chunk needs to know where its fragment references start.
+  static constexpr i64 CHUNK_SIZE = 1 << 16;
 
-  for (i64 i = 0; i < rels.size(); i++) {
+  if (rels.size() <= CHUNK_SIZE) {
+    apply_reloc_nonalloc(base, 0, rels.size(), 0);
+    return;
+  }
+
+  i64 num_chunks = (rels.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  std::vector<i64> ref_idx(num_chunks + 1);
+
+  tbb::parallel_for((i64)0, num_chunks, [&](i64 i) {
+    i64 end = std::min<i64>((i + 1) * CHUNK_SIZE, rels.size());
+    ref_idx[i + 1] = std::count(has_fragments.begin() + i * CHUNK_SIZE,
+                                has_fragments.begin() + end, true);
+  });
+
+  for (i64 i = 0; i < num_chunks; i++)
+    ref_idx[i + 1] += ref_idx[i];
+
+  tbb::parallel_for((i64)0, num_chunks, [&](i64 i) {
+    i64 end = std::min<i64>((i + 1) * CHUNK_SIZE, rels.size());
+    apply_reloc_nonalloc(base, i * CHUNK_SIZE, end, ref_idx[i]);
+  });
+}
+
+void InputSection::apply_reloc_nonalloc(u8 *base, i64 begin, i64 end,
+                                        i64 ref_idx) {
+  std::span<u64> local_addrs = file->get_local_addrs();
+  bool overflow = false;
+
+  for (i64 i = begin; i < end; i++) {
     const ElfRela &rel = rels[i];
+
+    // Fast path for the most common relocations, which refer to
+    // sections such as .text or .debug_abbrev. References to discarded
+    // sections are resolved to 0.
+    if (!has_fragments[i] && 0 < rel.r_sym && rel.r_sym < local_addrs.size() &&
+        (rel.r_type == R_X86_64_32 || rel.r_type == R_X86_64_64)) {
+      u64 addr = local_addrs[rel.r_sym];
+      u64 val = (addr == -1) ? 0 : addr + rel.r_addend;
+
+      if (rel.r_type == R_X86_64_32) {
+        overflow |= (val != (u32)val);
+        *(u32 *)(base + rel.r_offset) = val;
+      } else {
+        *(u64 *)(base + rel.r_offset) = val;
+      }
+      continue;
+    }
+
     Symbol &sym = *file->symbols[rel.r_sym];
 
     if (!sym.file || sym.is_placeholder) {
@@ -310,7 +433,13 @@ void InputSection::apply_reloc_nonalloc(u8 *base) {
     case R_X86_64_32:
     case R_X86_64_32S:
     case R_X86_64_64: {
-      u64 val = ref ? ref->frag->get_addr() : sym.get_addr();
+      u64 val;
+      if (ref)
+        val = ref->frag->get_addr() + ref->addend;
+      else if (sym.input_section && !sym.input_section->is_alive)
+        val = 0;
+      else
+        val = sym.get_addr() + rel.r_addend;
       overflow_check(this, sym, rel.r_type, val);
       write_val(rel.r_type, loc, val);
       break;
@@ -341,6 +470,17 @@ void InputSection::apply_reloc_nonalloc(u8 *base) {
       Error() << *this << ": unknown relocation: " << rel.r_type;
     }
   }
+
+  // Report overflows in the fast path.
+  if (overflow) {
+    for (i64 i = begin; i < end; i++) {
+      const ElfRela &rel = rels[i];
+      if (!has_fragments[i] && 0 < rel.r_sym && rel.r_sym < local_addrs.size() &&
+          rel.r_type == R_X86_64_32 && local_addrs[rel.r_sym] != -1)
+        overflow_check(this, *file->symbols[rel.r_sym], rel.r_type,
+                       local_addrs[rel.r_sym] + rel.r_addend);
+    }
+  }
 }
 
 // Linker has to create data structures in an output file to apply
@@ -356,7 +496,7 @@ void InputSection::scan_relocations() {
   counter.inc(rels.size());
 
   this->reldyn_offset = file->num_dynrel * sizeof(ElfRela);
-  this->rel_types.resize(rels.size());
+  this->rel_types = Arena::alloc_array<RelType>(rels.size());
 
   // Scan relocations
   for (i64 i = 0; i < rels.size(); i++) {
@@ -401,8 +541,16 @@ void InputSection::scan_relocations() {
         } else if (sym.is_relative()) {
           if (is_readonly)
             report_error();
-          rel_types[i] = R_ABS_DYN;
-          file->num_dynrel++;
+
+          // A relative relocation at a word-aligned address can be
+          // stored to .relr.dyn instead of .rela.dyn.
+          if (out::relrdyn && output_section->shdr.sh_addralign % 8 == 0 &&
+              (offset + rel.r_offset) % 8 == 0) {
+            rel_types[i] = R_ABS_RELR;
+          } else {
+            rel_types[i] = R_ABS_DYN;
+            file->num_dynrel++;
+          }
         } else {
           rel_types[i] = R_ABS;
         }
@@ -484,15 +632,72 @@ void InputSection::scan_relocations() {
       Error() << *this << ": unknown relocation: " << rel.r_type;
     }
   }
+
+  create_reloc_plan();
+}
+
+// Most relocations are PC-relative 32-bit ones or absolute 64-bit ones
+// against plain symbols. We apply them in separate tight loops, and the
+// remaining ones by the generic code.
+void InputSection::create_reloc_plan() {
+  enum { PC32, ABS64, OTHER };
+
+  auto get_kind = [&](i64 i) {
+    if (has_fragments[i])
+      return OTHER;
+
+    u32 r_type = rels[i].r_type;
+    if (rel_types[i] == R_PC && (r_type == R_X86_64_PC32 || r_type == R_X86_64_PLT32))
+      return PC32;
+    if ((rel_types[i] == R_ABS || rel_types[i] == R_ABS_RELR) &&
+        r_type == R_X86_64_64)
+      return ABS64;
+    return OTHER;
+  };
+
+  // TLS relaxations consume the following relocation as well.
+  auto for_each_rel = [&](auto fn) {
+    for (i64 i = 0; i < rels.size(); i++) {
+      fn(i, get_kind(i));
+      if (rel_types[i] == R_TLSGD_RELAX_LE || rel_types[i] == R_TLSLD_RELAX_LE)
+        i++;
+    }
+  };
+
+  i64 count[3] = {};
+  for_each_rel([&](i64 i, i64 kind) { count[kind]++; });
+
+  rel_plan = Arena::alloc_array<u32>(count[PC32] + count[ABS64] + count[OTHER]);
+  num_pc32_rels = count[PC32];
+  num_abs64_rels = count[ABS64];
+
+  i64 pos[3] = {0, count[PC32], count[PC32] + count[ABS64]};
+  for_each_rel([&](i64 i, i64 kind) { rel_plan[pos[kind]++] = i; });
 }
 
+// Returns the offset of the first null character of size `entsize`
+// which is aligned to `entsize` from the beginning of `data`.
 static size_t find_null(std::string_view data, u64 entsize) {
   if (entsize == 1)
     return data.find('\0');
 
-  for (i64 i = 0; i <= data.size() - entsize; i += entsize)
-    if (data.substr(i, i + entsize).find_first_not_of('\0') ==
-        std::string_view::npos)
+  const char *p = data.data();
+  i64 i = 0;
+
+  // Check 16 bytes at a time. Because 16 is a multiple of entsize,
+  // vector lanes are naturally aligned to characters.
+  if (entsize == 2 || entsize == 4) {
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= data.size(); i += 16) {
+      __m128i x = _mm_loadu_si128((__m128i *)(p + i));
+      __m128i eq = (entsize == 2) ? _mm_cmpeq_epi16(x, zero) : _mm_cmpeq_epi32(x, zero);
+      if (u32 mask = _mm_movemask_epi8(eq))
+        return i + (__builtin_ctz(mask) & ~(entsize - 1));
+    }
+  }
+
+  for (; i + entsize <= data.size(); i += entsize)
+    if (data.substr(i, entsize).find_first_not_of('\0') == std::string_view::npos)
       return i;
 
   return std::string_view::npos;
@@ -527,18 +732,21 @@ MergeableSection::MergeableSection(InputSection *isec)
   if (isec->shdr.sh_addralign >= (1 << 16))
     Fatal() << *isec << ": alignment too large";
 
+  // Split the section contents into fragments and compute their hashes
+  // first, and then insert them into the output section.
+  std::vector<u64> hashes;
+  u32 alignment = isec->shdr.sh_addralign;
+
   if (isec->shdr.sh_flags & SHF_STRINGS) {
     while (!data.empty()) {
       size_t end = find_null(data, entsize);
       if (end == std::string_view::npos)
-        Error() << *this << ": string is not null terminated";
+        Fatal() << *this << ": string is not null terminated";
 
       std::string_view substr = data.substr(0, end + entsize);
       data = data.substr(end + entsize);
-
-      SectionFragment *frag = parent.insert(substr, isec->shdr.sh_addralign);
-      fragments.push_back(frag);
       frag_offsets.push_back(substr.data() - begin);
+      hashes.push_back(hash_fragment(substr, alignment));
     }
   } else {
     if (data.size() % entsize)
@@ -547,13 +755,20 @@ MergeableSection::MergeableSection(InputSection *isec)
     while (!data.empty()) {
       std::string_view substr = data.substr(0, entsize);
       data = data.substr(entsize);
-
-      SectionFragment *frag = parent.insert(substr, isec->shdr.sh_addralign);
-      fragments.push_back(frag);
       frag_offsets.push_back(substr.data() - begin);
+      hashes.push_back(hash_fragment(substr, alignment));
     }
   }
 
+  std::string_view contents = isec->get_contents();
+  fragments.reserve(frag_offsets.size());
+
+  for (i64 i = 0; i < frag_offsets.size(); i++) {
+    u32 end = (i + 1 < frag_offsets.size()) ? frag_offsets[i + 1] : contents.size();
+    std::string_view substr = contents.substr(frag_offsets[i], end - frag_offsets[i]);
+    fragments.push_back(parent.insert(substr, hashes[i], alignment));
+  }
+
   static Counter counter("string_fragments");
   counter.inc(fragments.size());
 }
@@ -1,17 +1,30 @@
 #include "mold.h"
 
+#include <filesystem>
 #include <functional>
 #include <map>
 #include <signal.h>
+#include <sys/stat.h>
 #include <tbb/global_control.h>
 #include <tbb/parallel_do.h>
+#include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
-#include <tbb/task_group.h>
+#include <tbb/task_arena.h>
 #include <unordered_set>
 
-static tbb::task_group parser_tg;
 static bool preloading;
 
+// Input files are not parsed as soon as they are opened. Instead, we
+// collect them first and parse the largest ones first, so that a few
+// huge objects at the end of the command line don't become the
+// critical path while other cores are idle.
+struct ParseTask {
+  InputFile *file;
+  std::function<void()> fn;
+};
+
+static std::vector<ParseTask> parse_tasks;
+
 static bool is_text_file(MemoryMappedFile *mb) {
   return mb->size() >= 4 &&
          isprint(mb->data()[0]) &&
@@ -43,31 +56,63 @@ static FileType get_file_type(MemoryMappedFile *mb) {
 
 static ObjectFile *new_object_file(MemoryMappedFile *mb, std::string archive_name) {
   ObjectFile *file = new ObjectFile(mb, archive_name);
-  parser_tg.run([=]() { file->parse(); });
+  parse_tasks.push_back({file, [=]() { file->parse(); }});
   return file;
 }
 
+// Unlike new_object_file(), this function doesn't parse a given
+// archive member. The member will be parsed by resolve_symbols() only
+// when it turns out that the member is needed for the output.
+static ObjectFile *new_lazy_object_file(MemoryMappedFile *mb,
+                                        std::string archive_name,
+                                        std::vector<std::string_view> &syms) {
+  if (syms.empty())
+    return new_object_file(mb, archive_name);
+  return new ObjectFile(mb, archive_name, syms);
+}
+
 static SharedFile *new_shared_file(MemoryMappedFile *mb, bool as_needed) {
   SharedFile *file = new SharedFile(mb, as_needed);
-  parser_tg.run([=]() { file->parse(); });
+  parse_tasks.push_back({file, [=]() { file->parse(); }});
   return file;
 }
 
+// Returns the symbols defined by each archive member. An archive
+// without a symbol table gets empty lists, so that its members are
+// parsed eagerly.
+static std::vector<std::vector<std::string_view>>
+get_archive_symbols(MemoryMappedFile *mb, i64 num_members) {
+  std::vector<std::vector<std::string_view>> syms = read_archive_symtab(mb);
+  if (syms.empty())
+    return std::vector<std::vector<std::string_view>>(num_members);
+  if (syms.size() != num_members)
+    Fatal() << mb->name << ": archive symbol table doesn't match its members";
+  return syms;
+}
+
+// The preload server keeps parsed files in this cache, and a forked
+// child takes whatever it needs for its own command line. A file is
+// identified by its absolute path, size and mtime, because clients may
+// run in different directories.
 template <typename T>
 class FileCache {
 public:
   void store(MemoryMappedFile *mb, T *obj) {
-    Key k(mb->name, mb->size(), mb->mtime);
-    cache[k].push_back(obj);
+    cache[get_key(mb)].push_back(obj);
   }
 
   std::vector<T *> get(MemoryMappedFile *mb) {
-    Key k(mb->name, mb->size(), mb->mtime);
+    Key k = get_key(mb);
     std::vector<T *> objs = cache[k];
     cache[k].clear();
     return objs;
   }
 
+  bool contains(MemoryMappedFile *mb) {
+    auto it = cache.find(get_key(mb));
+    return it != cache.end() && !it->second.empty();
+  }
+
   T *get_one(MemoryMappedFile *mb) {
     std::vector<T *> objs = get(mb);
     return objs.empty() ? nullptr : objs[0];
@@ -75,6 +120,12 @@ public:
 
 private:
   typedef std::tuple<std::string, i64, i64> Key;
+
+  static Key get_key(MemoryMappedFile *mb) {
+    std::string path = std::filesystem::absolute(mb->name).lexically_normal();
+    return {path, mb->size(), mb->mtime};
+  }
+
   std::map<Key, std::vector<T *>> cache;
 };
 
@@ -82,21 +133,27 @@ void read_file(MemoryMappedFile *mb, bool as_needed) {
   static FileCache<ObjectFile> obj_cache;
   static FileCache<SharedFile> dso_cache;
 
+  // The preload server calls this function repeatedly with the same
+  // set of files. Files are parsed only when they are new or updated.
   if (preloading) {
     switch (get_file_type(mb)) {
     case FileType::OBJ:
-      obj_cache.store(mb, new_object_file(mb, ""));
+      if (!obj_cache.contains(mb))
+        obj_cache.store(mb, new_object_file(mb, ""));
       return;
     case FileType::DSO:
-      dso_cache.store(mb, new_shared_file(mb, as_needed));
+      if (!dso_cache.contains(mb))
+        dso_cache.store(mb, new_shared_file(mb, as_needed));
       return;
     case FileType::AR:
-      for (MemoryMappedFile *child : read_fat_archive_members(mb))
-        obj_cache.store(mb, new_object_file(child, mb->name));
+      if (!obj_cache.contains(mb))
+        for (MemoryMappedFile *child : read_fat_archive_members(mb))
+          obj_cache.store(mb, new_object_file(child, mb->name));
       return;
     case FileType::THIN_AR:
       for (MemoryMappedFile *child : read_thin_archive_members(mb))
-        obj_cache.store(child, new_object_file(child, mb->name));
+        if (!obj_cache.contains(child))
+          obj_cache.store(child, new_object_file(child, mb->name));
       return;
     case FileType::TEXT:
       parse_linker_script(mb, as_needed);
@@ -105,35 +162,53 @@ void read_file(MemoryMappedFile *mb, bool as_needed) {
     Fatal() << mb->name << ": unknown file type";
   }
 
+  static Counter preloaded("preloaded_files");
+
   switch (get_file_type(mb)) {
   case FileType::OBJ:
-    if (ObjectFile *obj = obj_cache.get_one(mb))
+    if (ObjectFile *obj = obj_cache.get_one(mb)) {
       out::objs.push_back(obj);
-    else
+      preloaded.inc();
+    } else {
       out::objs.push_back(new_object_file(mb, ""));
+    }
     return;
   case FileType::DSO:
-    if (SharedFile *obj = dso_cache.get_one(mb))
+    if (SharedFile *obj = dso_cache.get_one(mb)) {
       out::dsos.push_back(obj);
-    else
+      preloaded.inc();
+    } else {
       out::dsos.push_back(new_shared_file(mb, as_needed));
+    }
     return;
   case FileType::AR:
     if (std::vector<ObjectFile *> objs = obj_cache.get(mb); !objs.empty()) {
       append(out::objs, objs);
+      preloaded.inc();
     } else {
-      for (MemoryMappedFile *child : read_archive_members(mb))
-        out::objs.push_back(new_object_file(child, mb->name));
+      std::vector<MemoryMappedFile *> members = read_fat_archive_members(mb);
+      std::vector<std::vector<std::string_view>> syms =
+        get_archive_symbols(mb, members.size());
+
+      for (i64 i = 0; i < members.size(); i++)
+        out::objs.push_back(new_lazy_object_file(members[i], mb->name, syms[i]));
     }
     return;
-  case FileType::THIN_AR:
-    for (MemoryMappedFile *child : read_thin_archive_members(mb)) {
-      if (ObjectFile *obj = obj_cache.get_one(child))
+  case FileType::THIN_AR: {
+    std::vector<MemoryMappedFile *> members = read_thin_archive_members(mb);
+    std::vector<std::vector<std::string_view>> syms =
+      get_archive_symbols(mb, members.size());
+
+    for (i64 i = 0; i < members.size(); i++) {
+      if (ObjectFile *obj = obj_cache.get_one(members[i])) {
         out::objs.push_back(obj);
-      else
-        out::objs.push_back(new_object_file(child, mb->name));
+        preloaded.inc();
+      } else {
+        out::objs.push_back(new_lazy_object_file(members[i], mb->name, syms[i]));
+      }
     }
     return;
+  }
   case FileType::TEXT:
     parse_linker_script(mb, as_needed);
     return;
@@ -178,10 +253,26 @@ static void resolve_symbols() {
   tbb::parallel_do(roots,
                    [&](ObjectFile *file,
                        tbb::parallel_do_feeder<ObjectFile *> &feeder) {
-                     file->mark_live_objects(
-                       [&](ObjectFile *obj) { feeder.add(obj); });
+                     // Parse an archive member if it is pulled out for
+                     // the first time.
+                     if (file->is_lazy) {
+                       file->is_lazy = false;
+                       file->parse();
+                       file->resolve_symbols();
+                     }
+
+                     file->mark_live_objects(feeder);
                    });
 
+  // Now that we know the owner of each symbol, set symbol members.
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    file->claim_resolved_symbols();
+  });
+
+  tbb::parallel_for_each(out::dsos, [](SharedFile *file) {
+    file->claim_resolved_symbols();
+  });
+
   // Eliminate unused archive members and as-needed DSOs.
   erase(out::objs, [](InputFile *file) { return !file->is_alive; });
   erase(out::dsos, [](InputFile *file) { return !file->is_alive; });
@@ -231,19 +322,68 @@ static void handle_mergeable_strings() {
     }
   });
 
-  // Assign each mergeable input section a unique index.
-  for (ObjectFile *file : out::objs) {
-    for (MergeableSection *isec : file->mergeable_sections) {
-      i64 offset = isec->parent.shdr.sh_size;
-      i64 alignment = isec->shdr.sh_addralign;
-      isec->padding = align_to(offset, alignment) - offset;
-      isec->offset = offset + isec->padding;
-      isec->parent.shdr.sh_size = offset + isec->padding + isec->size;
-
-      isec->parent.shdr.sh_addralign =
-        std::max(isec->parent.shdr.sh_addralign, isec->shdr.sh_addralign);
-    }
-  }
+  // Create a list of member input sections for each merged section.
+  i64 unit = (out::objs.size() + 127) / 128;
+  std::vector<std::span<ObjectFile *>> slices = split(out::objs, unit);
+  i64 num_osec = MergedSection::instances.size();
+
+  std::vector<std::vector<std::vector<MergeableSection *>>> groups(slices.size());
+  for (i64 i = 0; i < groups.size(); i++)
+    groups[i].resize(num_osec);
+
+  tbb::parallel_for((i64)0, (i64)slices.size(), [&](i64 i) {
+    for (ObjectFile *file : slices[i])
+      for (MergeableSection *isec : file->mergeable_sections)
+        groups[i][isec->parent.idx].push_back(isec);
+  });
+
+  tbb::parallel_for((i64)0, num_osec, [&](i64 j) {
+    MergedSection *osec = MergedSection::instances[j];
+    for (i64 i = 0; i < groups.size(); i++)
+      append(osec->members, groups[i][j]);
+  });
+
+  // Assign offsets within merged sections to mergeable input sections.
+  tbb::parallel_for_each(MergedSection::instances, [&](MergedSection *osec) {
+    if (osec->members.empty())
+      return;
+
+    std::vector<std::span<MergeableSection *>> slices = split(osec->members, 10000);
+    std::vector<i64> size(slices.size());
+    std::vector<i64> alignments(slices.size());
+
+    tbb::parallel_for((i64)0, (i64)slices.size(), [&](i64 i) {
+      i64 off = 0;
+      i64 align = 1;
+
+      for (MergeableSection *isec : slices[i]) {
+        i64 start = align_to(off, isec->shdr.sh_addralign);
+        isec->padding = start - off;
+        isec->offset = start;
+        off = start + isec->size;
+        align = std::max<i64>(align, isec->shdr.sh_addralign);
+      }
+
+      size[i] = off;
+      alignments[i] = align;
+    });
+
+    i64 align = *std::max_element(alignments.begin(), alignments.end());
+
+    std::vector<i64> start(slices.size());
+    for (i64 i = 1; i < slices.size(); i++)
+      start[i] = align_to(start[i - 1] + size[i - 1], align);
+
+    tbb::parallel_for((i64)1, (i64)slices.size(), [&](i64 i) {
+      // The gap between slices becomes padding of the first member.
+      slices[i][0]->padding = start[i] - start[i - 1] - size[i - 1];
+      for (MergeableSection *isec : slices[i])
+        isec->offset += start[i];
+    });
+
+    osec->shdr.sh_size = start.back() + size.back();
+    osec->shdr.sh_addralign = std::max<i64>(osec->shdr.sh_addralign, align);
+  });
 }
 
 // So far, each input section has a pointer to its corresponding
@@ -319,10 +459,10 @@ static void set_isec_offsets() {
       i64 off = 0;
       i64 align = 1;
 
-      for (InputChunk *isec : slices[i]) {
+      for (InputSection *isec : slices[i]) {
         off = align_to(off, isec->shdr.sh_addralign);
         isec->offset = off;
-        off += isec->shdr.sh_size;
+        off += isec->shdr.sh_size + isec->slack;
         align = std::max<i64>(align, isec->shdr.sh_addralign);
       }
 
@@ -439,7 +579,27 @@ static void fill_symbol_versions() {
                              out::dynsym->symbols.end());
   erase(syms, [](Symbol *sym){ return sym->ver_idx < 2; });
 
-  if (syms.empty())
+  auto get_verstr = [](Symbol *sym) {
+    return ((SharedFile *)sym->file)->version_strings[sym->ver_idx];
+  };
+
+  // glibc refuses to load an executable with DT_RELR unless it
+  // depends on the GLIBC_ABI_DT_RELR version of libc.
+  SharedFile *libc = nullptr;
+  if (out::relrdyn && out::relrdyn->shdr.sh_size)
+    for (SharedFile *file : out::dsos)
+      if (file->soname.starts_with("libc.so."))
+        libc = file;
+
+  // Version strings are the last strings added to .dynstr, so we can
+  // fix the layout of .dynstr here.
+  for (Symbol *sym : syms)
+    out::dynstr->add_string(get_verstr(sym));
+  if (libc)
+    out::dynstr->add_string("GLIBC_ABI_DT_RELR");
+  out::dynstr->finalize();
+
+  if (syms.empty() && !libc)
     return;
 
   sort(syms, [](Symbol *a, Symbol *b) {
@@ -451,13 +611,15 @@ static void fill_symbol_versions() {
   out::versym->contents.resize(out::dynsym->symbols.size(), 1);
   out::versym->contents[0] = 0;
 
-  i64 sz = sizeof(ElfVerneed) + sizeof(ElfVernaux);
+  i64 sz = syms.empty() ? 0 : sizeof(ElfVerneed) + sizeof(ElfVernaux);
   for (i64 i = 1; i < syms.size(); i++) {
     if (syms[i - 1]->file != syms[i]->file)
       sz += sizeof(ElfVerneed) + sizeof(ElfVernaux);
     else if (syms[i - 1]->ver_idx != syms[i]->ver_idx)
       sz += sizeof(ElfVernaux);
   }
+  if (libc)
+    sz += sizeof(ElfVerneed) + sizeof(ElfVernaux);
   out::verneed->contents.resize(sz);
 
   // Fill .gnu.versoin_r.
@@ -466,10 +628,7 @@ static void fill_symbol_versions() {
   ElfVerneed *verneed = nullptr;
   ElfVernaux *aux = nullptr;
 
-  auto add_aux = [&](Symbol *sym) {
-    SharedFile *file = (SharedFile *)sym->file;
-    std::string_view verstr = file->version_strings[sym->ver_idx];
-
+  auto add_aux = [&](std::string_view verstr) {
     verneed->vn_cnt++;
     if (aux)
       aux->vna_next = sizeof(ElfVernaux);
@@ -478,12 +637,10 @@ static void fill_symbol_versions() {
     buf += sizeof(*aux);
     aux->vna_hash = elf_hash(verstr);
     aux->vna_other = ++version;
-    aux->vna_name = out::dynstr->add_string(verstr);
+    aux->vna_name = out::dynstr->find_string(verstr);
   };
 
-  auto add_verneed = [&](Symbol *sym) {
-    SharedFile *file = (SharedFile *)sym->file;
-
+  auto add_verneed = [&](SharedFile *file, std::string_view verstr) {
     out::verneed->shdr.sh_info++;
     if (verneed)
       verneed->vn_next = buf - (u8 *)verneed;
@@ -495,34 +652,32 @@ static void fill_symbol_versions() {
     verneed->vn_aux = sizeof(ElfVerneed);
 
     aux = nullptr;
-    add_aux(sym);
+    add_aux(verstr);
   };
 
-  add_verneed(syms[0]);
-  out::versym->contents[syms[0]->dynsym_idx] = version;
-
-  for (i64 i = 1; i < syms.size(); i++) {
-    if (syms[i - 1]->file != syms[i]->file)
-      add_verneed(syms[i]);
+  for (i64 i = 0; i < syms.size(); i++) {
+    if (i == 0 || syms[i - 1]->file != syms[i]->file)
+      add_verneed((SharedFile *)syms[i]->file, get_verstr(syms[i]));
     else if (syms[i - 1]->ver_idx != syms[i]->ver_idx)
-      add_aux(syms[i]);
-    out::versym->contents[syms[i]->dynsym_idx] = version;
+      add_aux(get_verstr(syms[i]));
+    out::versym->contents[syms[i]->get_dynsym_idx()] = version;
   }
+
+  // No symbol refers to this version, so it gets its own entry.
+  if (libc)
+    add_verneed(libc, "GLIBC_ABI_DT_RELR");
 }
 
-static void clear_padding(i64 filesize) {
-  Timer t("clear_padding");
+// Zero-clears the padding after a given chunk.
+static void clear_padding(i64 idx, i64 filesize) {
+  OutputChunk *chunk = out::chunks[idx];
+  i64 next_start = (idx == out::chunks.size() - 1)
+    ? filesize : out::chunks[idx + 1]->shdr.sh_offset;
 
-  auto zero = [](OutputChunk *chunk, i64 next_start) {
-    i64 pos = chunk->shdr.sh_offset;
-    if (chunk->shdr.sh_type != SHT_NOBITS)
-      pos += chunk->shdr.sh_size;
-    memset(out::buf + pos, 0, next_start - pos);
-  };
-
-  for (i64 i = 1; i < out::chunks.size(); i++)
-    zero(out::chunks[i - 1], out::chunks[i]->shdr.sh_offset);
-  zero(out::chunks.back(), filesize);
+  i64 pos = chunk->shdr.sh_offset;
+  if (chunk->shdr.sh_type != SHT_NOBITS)
+    pos += chunk->shdr.sh_size;
+  memset(out::buf + pos, 0, next_start - pos);
 }
 
 // We want to sort output sections in the following order.
@@ -551,15 +706,26 @@ static i64 set_osec_offsets(std::span<OutputChunk *> chunks) {
 
   i64 fileoff = 0;
   i64 vaddr = config.image_base;
+  bool in_text = false;
 
   for (OutputChunk *chunk : chunks) {
-    if (chunk->starts_new_ptload)
-      vaddr = align_to(vaddr, PAGE_SIZE);
+    // With -z hugepage-text, the executable segment starts and ends at
+    // huge page boundaries so that it can be backed by huge pages
+    // without sharing them with other segments.
+    i64 page_size = PAGE_SIZE;
+
+    if (chunk->starts_new_ptload) {
+      bool is_text = chunk->shdr.sh_flags & SHF_EXECINSTR;
+      if (config.z_hugepage_text && (is_text || in_text))
+        page_size = HUGE_PAGE_SIZE;
+      in_text = is_text;
+      vaddr = align_to(vaddr, page_size);
+    }
 
-    if (vaddr % PAGE_SIZE > fileoff % PAGE_SIZE)
-      fileoff += vaddr % PAGE_SIZE - fileoff % PAGE_SIZE;
-    else if (vaddr % PAGE_SIZE < fileoff % PAGE_SIZE)
-      fileoff = align_to(fileoff, PAGE_SIZE) + vaddr % PAGE_SIZE;
+    if (vaddr % page_size > fileoff % page_size)
+      fileoff += vaddr % page_size - fileoff % page_size;
+    else if (vaddr % page_size < fileoff % page_size)
+      fileoff = align_to(fileoff, page_size) + vaddr % page_size;
 
     fileoff = align_to(fileoff, chunk->shdr.sh_addralign);
     vaddr = align_to(vaddr, chunk->shdr.sh_addralign);
@@ -579,6 +745,33 @@ static i64 set_osec_offsets(std::span<OutputChunk *> chunks) {
   return fileoff;
 }
 
+// Replaces .debug_* output sections with compressed ones. Section
+// contents are rendered to a temporary buffer and then compressed,
+// so this has to be called after the file layout is fixed.
+static void compress_debug_sections() {
+  Timer t("compress_debug_sections");
+
+  // Only regular and merged sections implement write_to().
+  std::unordered_set<OutputChunk *> merged(MergedSection::instances.begin(),
+                                           MergedSection::instances.end());
+
+  tbb::parallel_for((i64)0, (i64)out::chunks.size(), [&](i64 i) {
+    OutputChunk &chunk = *out::chunks[i];
+    if ((chunk.kind != OutputChunk::REGULAR && !merged.count(&chunk)) ||
+        (chunk.shdr.sh_flags & SHF_ALLOC) ||
+        chunk.shdr.sh_type == SHT_NOBITS ||
+        !chunk.name.starts_with(".debug"))
+      return;
+
+    // Keep the original section if it doesn't shrink.
+    CompressedSection *sec = new CompressedSection(chunk);
+    if (sec->shdr.sh_size < chunk.shdr.sh_size)
+      out::chunks[i] = sec;
+    else
+      delete sec;
+  });
+}
+
 static void fix_synthetic_symbols(std::span<OutputChunk *> chunks) {
   auto start = [](Symbol *sym, OutputChunk *chunk) {
     if (sym) {
@@ -673,18 +866,30 @@ static void signal_handler(int) {
   _exit(1);
 }
 
-MemoryMappedFile *find_library(std::string name,
-                               std::span<std::string_view> lib_paths) {
+static std::string find_library_path(std::string name,
+                                     std::span<std::string_view> lib_paths) {
+  auto exists = [](const std::string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+  };
+
   for (std::string_view dir : lib_paths) {
     std::string root = dir.starts_with("/") ? config.sysroot : "";
     std::string stem = root + std::string(dir) + "/lib" + name;
-    if (!config.is_static)
-      if (MemoryMappedFile *mb = MemoryMappedFile::open(stem + ".so"))
-        return mb;
-    if (MemoryMappedFile *mb = MemoryMappedFile::open(stem + ".a"))
-      return mb;
+    if (!config.is_static && exists(stem + ".so"))
+      return stem + ".so";
+    if (exists(stem + ".a"))
+      return stem + ".a";
   }
-  Fatal() << "library not found: " << name;
+  return "";
+}
+
+MemoryMappedFile *find_library(std::string name,
+                               std::span<std::string_view> lib_paths) {
+  std::string path = find_library_path(name, lib_paths);
+  if (path.empty())
+    Fatal() << "library not found: " << name;
+  return MemoryMappedFile::must_open(path);
 }
 
 static std::vector<std::string> add_dashes(std::string name) {
@@ -824,41 +1029,29 @@ static std::vector<std::string_view> expand_response_files(char **argv) {
   return vec;
 }
 
-static std::vector<std::string_view> get_input_files(std::span<std::string_view> args) {
-  static std::unordered_set<std::string_view> needs_arg({
-    "o", "dynamic-linker", "export-dynamic", "e", "entry", "y",
-    "trace-symbol", "filler", "sysroot", "thread-count", "z",
-    "hash-style", "m", "rpath", "version-script",
-  });
-
-  std::vector<std::string_view> vec;
-  std::vector<std::string> library_paths;
-
-  while (args.empty()) {
-    if (needs_arg.contains(args[0])) {
-      if (args.size() == 1)
-        Fatal() << args[0] << ": missing argument";
-      args = args.subspan(2);
-      continue;
-    }
+// Returns the paths of input files in positional arguments, so that we
+// can start reading them before read_input_files() opens them one by
+// one. Libraries that are not found are ignored here; they are
+// reported by read_input_files().
+static std::vector<std::string> get_input_files(std::span<std::string_view> args) {
+  std::vector<std::string> vec;
 
+  while (!args.empty()) {
     std::string_view arg;
 
-    if (read_arg(args, arg, "L") || read_arg(args, arg, "library-path")) {
-      library_paths.push_back(std::string(arg));
-    }
-
-    if (read_arg(args, arg, "l")) {
-      vec.push_back(arg);
+    if (read_flag(args, "as-needed") || read_flag(args, "no-as-needed"))
       continue;
-    }
 
-    if (args[0].starts_with("-")) {
-      args = args.subspan(1);
+    if (read_arg(args, arg, "l")) {
+      std::string path = find_library_path(std::string(arg), config.library_paths);
+      if (!path.empty())
+        vec.push_back(path);
       continue;
     }
 
-    vec.push_back(args[0]);
+    // Skip other flags such as --whole-archive, which are not files.
+    if (!args[0].starts_with('-'))
+      vec.push_back(std::string(args[0]));
     args = args.subspan(1);
   }
   return vec;
@@ -883,6 +1076,16 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
       conf.entry = arg;
     } else if (read_flag(args, "print-map")) {
       conf.print_map = true;
+    } else if (read_arg(args, arg, "Map")) {
+      conf.map_file = arg;
+      conf.print_map = true;
+    } else if (read_arg(args, arg, "map-format")) {
+      if (arg == "text")
+        conf.map_format = MapFormat::TEXT;
+      else if (arg == "json")
+        conf.map_format = MapFormat::JSON;
+      else
+        Fatal() << "invalid --map-format argument: " << arg;
     } else if (read_flag(args, "stat")) {
       conf.stat = true;
     } else if (read_flag(args, "static")) {
@@ -926,8 +1129,21 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
       conf.relax = false;
     } else if (read_flag(args, "perf")) {
       conf.perf = true;
+    } else if (read_flag(args, "perf-counters")) {
+      conf.perf = true;
+      conf.perf_counters = true;
+    } else if (read_arg(args, arg, "perf-trace")) {
+      conf.perf_trace = arg;
     } else if (read_z_flag(args, "now")) {
       conf.z_now = true;
+    } else if (read_z_flag(args, "pack-relative-relocs")) {
+      conf.z_pack_relative_relocs = true;
+    } else if (read_z_flag(args, "nopack-relative-relocs")) {
+      conf.z_pack_relative_relocs = false;
+    } else if (read_z_flag(args, "hugepage-text")) {
+      conf.z_hugepage_text = true;
+    } else if (read_z_flag(args, "nohugepage-text")) {
+      conf.z_hugepage_text = false;
     } else if (read_flag(args, "fork")) {
       conf.fork = true;
     } else if (read_flag(args, "no-fork")) {
@@ -942,8 +1158,32 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
       conf.print_gc_sections = false;
     } else if (read_flag(args, "icf")) {
       conf.icf = true;
+      conf.icf_all = true;
     } else if (read_flag(args, "no-icf")) {
       conf.icf = false;
+    } else if (read_arg(args, arg, "icf-hash")) {
+      if (arg == "fast")
+        conf.icf_hash = IcfHashKind::FAST;
+      else if (arg == "sha256")
+        conf.icf_hash = IcfHashKind::SHA256;
+      else
+        Fatal() << "invalid --icf-hash argument: " << arg;
+    } else if (read_arg(args, arg, "icf")) {
+      if (arg == "all") {
+        conf.icf = true;
+        conf.icf_all = true;
+      } else if (arg == "safe") {
+        conf.icf = true;
+        conf.icf_all = false;
+      } else if (arg == "none") {
+        conf.icf = false;
+      } else {
+        Fatal() << "invalid --icf argument: " << arg;
+      }
+    } else if (read_flag(args, "incremental")) {
+      conf.incremental = true;
+    } else if (read_flag(args, "no-incremental")) {
+      conf.incremental = false;
     } else if (read_flag(args, "print-icf-sections")) {
       conf.print_icf_sections = true;
     } else if (read_flag(args, "no-print-icf-sections")) {
@@ -981,8 +1221,25 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
         conf.build_id = BuildIdKind::UUID;
       else if (arg == "sha256")
         conf.build_id = BuildIdKind::SHA256;
+      else if (arg == "fast")
+        conf.build_id = BuildIdKind::FAST;
       else
         Fatal() << "invalid --build-id argument: " << arg;
+    } else if (read_arg(args, arg, "symbol-ordering-file")) {
+      conf.symbol_ordering_file = arg;
+    } else if (read_arg(args, arg, "call-graph-ordering-file")) {
+      conf.call_graph_ordering_file = arg;
+    } else if (read_flag(args, "call-graph-profile-sort")) {
+      conf.call_graph_profile_sort = true;
+    } else if (read_flag(args, "no-call-graph-profile-sort")) {
+      conf.call_graph_profile_sort = false;
+    } else if (read_arg(args, arg, "compress-debug-sections")) {
+      if (arg == "none")
+        conf.compress_debug_sections = CompressKind::NONE;
+      else if (arg == "zlib" || arg == "zlib-gabi")
+        conf.compress_debug_sections = CompressKind::ZLIB;
+      else
+        Fatal() << "invalid --compress-debug-sections argument: " << arg;
     } else if (read_flag(args, "preload")) {
       conf.preload = true;
     } else if (read_arg(args, arg, "z")) {
@@ -1026,7 +1283,24 @@ static void read_input_files(std::span<std::string_view> args) {
       args = args.subspan(1);
     }
   }
-  parser_tg.wait();
+
+  // Each worker takes the largest remaining file. Large files use
+  // nested parallelism internally, so idle workers help with them
+  // once the queue is drained.
+  sort(parse_tasks, [](const ParseTask &a, const ParseTask &b) {
+    return a.file->mb->size() > b.file->mb->size();
+  });
+
+  std::atomic_int64_t next = 0;
+  tbb::parallel_for((i64)0, (i64)tbb::this_task_arena::max_concurrency(),
+                    [&](i64) {
+    for (i64 i = next++; i < parse_tasks.size(); i = next++) {
+      ParseTimer t(parse_tasks[i].file);
+      parse_tasks[i].fn();
+    }
+  }, tbb::simple_partitioner());
+
+  parse_tasks.clear();
 }
 
 static void show_stats() {
@@ -1050,8 +1324,6 @@ static void show_stats() {
 }
 
 int main(int argc, char **argv) {
-  Timer t_all("all");
-
   // Parse non-positional command line options
   std::vector<std::string_view> arg_vector = expand_response_files(argv + 1);
   std::vector<std::string_view> file_args;
@@ -1064,9 +1336,6 @@ int main(int argc, char **argv) {
     if (i64 code; resume_daemon(argv, &code))
       exit(code);
 
-  tbb::global_control tbb_cont(tbb::global_control::max_allowed_parallelism,
-                               config.thread_count);
-
   signal(SIGINT, signal_handler);
   signal(SIGTERM, signal_handler);
 
@@ -1074,17 +1343,46 @@ int main(int argc, char **argv) {
   std::function<void()> on_complete;
 
   if (config.preload) {
-    std::function<void()> wait_for_client;
-    daemonize(argv, &wait_for_client, &on_complete);
-    preloading = true;
-    read_input_files(file_args);
-    wait_for_client();
+    // The server keeps parsed input files in memory and serves links
+    // in forked children. Preloading is done without worker threads
+    // because they wouldn't survive fork().
+    std::vector<std::string_view> preload_args = file_args;
+
+    argv = daemonize([&]() {
+      tbb::global_control tbb_cont(tbb::global_control::max_allowed_parallelism, 1);
+      preloading = true;
+      read_input_files(preload_args);
+      preloading = false;
+    }, &on_complete);
+
+    // Now we are in a child process serving a client.
+    arg_vector = expand_response_files(argv + 1);
+    file_args.clear();
+    config = parse_nonpositional_args(arg_vector, file_args);
+
+    if (config.output == "")
+      Fatal() << "-o option is missing";
   } else if (config.fork) {
     on_complete = fork_child();
   }
 
-  if (config.stat)
+  // Start reading input files in background.
+  MemoryMappedFile::prefetch(get_input_files(file_args));
+
+  // Counters must be opened before worker threads are created so that
+  // they are inherited by the workers.
+  if (config.perf_counters)
+    PerfCounters::start();
+
+  Timer t_all("all");
+
+  tbb::global_control tbb_cont(tbb::global_control::max_allowed_parallelism,
+                               config.thread_count);
+
+  if (config.stat || !config.perf_trace.empty())
     Counter::enabled = true;
+  if (!config.perf_trace.empty())
+    start_perf_trace();
   if (config.pie)
     config.image_base = 0;
 
@@ -1143,6 +1441,8 @@ int main(int argc, char **argv) {
     out::interp = new InterpSection;
     out::dynamic = new DynamicSection;
     out::reldyn = new RelDynSection;
+    if (config.pie && config.z_pack_relative_relocs)
+      out::relrdyn = new RelrDynSection;
     out::versym = new VersymSection;
     out::verneed = new VerneedSection;
   }
@@ -1152,6 +1452,7 @@ int main(int argc, char **argv) {
   out::chunks.push_back(out::gotplt);
   out::chunks.push_back(out::relplt);
   out::chunks.push_back(out::reldyn);
+  out::chunks.push_back(out::relrdyn);
   out::chunks.push_back(out::dynamic);
   out::chunks.push_back(out::dynsym);
   out::chunks.push_back(out::dynstr);
@@ -1178,6 +1479,12 @@ int main(int argc, char **argv) {
   for (SharedFile *file : out::dsos)
     file->priority = priority++;
 
+  out::files_by_priority.resize(priority);
+  for (ObjectFile *file : out::objs)
+    out::files_by_priority[file->priority] = file;
+  for (SharedFile *file : out::dsos)
+    out::files_by_priority[file->priority] = file;
+
   // Resolve symbols and fix the set of object files that are
   // included to the final output.
   resolve_symbols();
@@ -1214,6 +1521,13 @@ int main(int argc, char **argv) {
   // Bin input sections into output sections
   bin_sections();
 
+  // Reorder sections within output sections for runtime locality.
+  order_sections();
+
+  // Reserve room for sections to grow if --incremental is given.
+  if (config.incremental)
+    prepare_incremental_link(arg_vector);
+
   // Assign offsets within an output section to input sections.
   set_isec_offsets();
 
@@ -1246,7 +1560,9 @@ int main(int argc, char **argv) {
   // Create a dummy file containing linker-synthesized symbols
   // (e.g. `__bss_start`).
   out::internal_file = new ObjectFile;
+  out::files_by_priority[1] = out::internal_file;
   out::internal_file->resolve_symbols();
+  out::internal_file->claim_resolved_symbols();
   out::objs.push_back(out::internal_file);
 
   // Convert weak symbols to absolute symbols with value 0.
@@ -1255,6 +1571,9 @@ int main(int argc, char **argv) {
     tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
       file->handle_undefined_weak_symbols();
     });
+    tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+      file->claim_resolved_symbols();
+    });
   }
 
   // Beyond this point, no new symbols will be added to the result.
@@ -1282,6 +1601,11 @@ int main(int argc, char **argv) {
   // .got.plt, .dynsym, .dynstr, etc.
   scan_rels();
 
+  // Relative relocations in .relr.dyn are encoded as offsets from the
+  // start of output sections, so they can be computed before layout.
+  if (out::relrdyn)
+    out::relrdyn->construct();
+
   // Put symbols to .dynsym.
   export_dynamic();
 
@@ -1349,34 +1673,53 @@ int main(int argc, char **argv) {
     }
   }
 
+  // Compressing debug sections shrinks them, so the trailing non-alloc
+  // sections need new file offsets.
+  if (config.compress_debug_sections != CompressKind::NONE) {
+    compress_debug_sections();
+    filesize = set_osec_offsets(out::chunks);
+  }
+
   t_before_copy.stop();
 
   // Create an output file
   OutputFile *file = OutputFile::open(config.output, filesize);
   out::buf = file->buf;
 
+  if (config.incremental)
+    reuse_previous_output(file);
+
   Timer t_copy("copy");
 
-  // Copy input sections to the output file
+  // Copy input sections to the output file. If we need a build ID,
+  // the output file is hashed as it is written.
   {
     Timer t("copy_buf");
-    tbb::parallel_for_each(out::chunks, [&](OutputChunk *chunk) {
-      chunk->copy_buf();
+    if (out::buildid)
+      out::buildid->start_hashing(filesize);
+
+    tbb::parallel_for((i64)0, (i64)out::chunks.size(), [&](i64 i) {
+      out::chunks[i]->copy_buf();
+      clear_padding(i, filesize);
+      if (out::buildid)
+        out::buildid->chunk_written(i);
     });
     Error::checkpoint();
   }
 
-  // Zero-clear paddings between sections
-  clear_padding(filesize);
-
   // Commit
   if (out::buildid) {
     Timer t("build_id");
-    out::buildid->write_buildid(filesize);
+    out::buildid->write_buildid();
   }
 
   file->close();
 
+  if (config.incremental) {
+    write_incremental_state(filesize);
+    Error::checkpoint();
+  }
+
   t_copy.stop();
   t_total.stop();
   t_all.stop();
@@ -1385,11 +1728,16 @@ int main(int argc, char **argv) {
     print_map();
 
   // Show stats numbers
-  if (Counter::enabled)
+  if (config.stat)
     show_stats();
 
-  if (config.perf)
+  if (config.perf) {
     Timer::print();
+    ParseTimer::print();
+  }
+
+  if (!config.perf_trace.empty())
+    write_perf_trace(config.perf_trace);
 
   std::cout << std::flush;
   std::cerr << std::flush;
@@ -1,47 +1,215 @@
+// This file implements -Map and --print-map. A map file is a plain
+// text listing of output sections, their members and symbols. With
+// --map-format=json, the same information is written as JSON so that
+// other tools can read it without parsing the text format.
+//
+// Output sections are formatted in parallel. Members are split into
+// shards of a fixed size, each of which is formatted into its own
+// buffer, and the buffers are written out with a single write.
+
 #include "mold.h"
 
 #include <iomanip>
 #include <ios>
-#include <unordered_map>
+#include <sstream>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
 
-void print_map() {
-  // Construct a section-to-symbol map.
-  std::unordered_map<InputChunk *, std::vector<Symbol *>> map;
-  for (ObjectFile *file : out::objs)
+static constexpr i64 SHARD_SIZE = 4096;
+
+struct MapEntry {
+  InputChunk *isec;
+  Symbol *sym;
+};
+
+// Returns symbols grouped by sections and sorted by address. Section
+// symbols are omitted because they have no names.
+static std::vector<MapEntry> get_symbols() {
+  std::vector<std::vector<MapEntry>> vec(out::objs.size());
+
+  tbb::parallel_for((i64)0, (i64)out::objs.size(), [&](i64 i) {
+    ObjectFile *file = out::objs[i];
     for (Symbol *sym : file->symbols)
-      if (sym->file == file && sym->input_section)
-        map[sym->input_section].push_back(sym);
+      if (sym->file == file && sym->input_section && !sym->name.empty())
+        vec[i].push_back({sym->input_section, sym});
+  });
+
+  std::vector<MapEntry> syms;
+  for (std::vector<MapEntry> &v : vec)
+    append(syms, v);
+
+  tbb::parallel_sort(syms.begin(), syms.end(),
+                     [](const MapEntry &a, const MapEntry &b) {
+    return std::tuple(a.isec, a.sym->value, a.sym->name) <
+           std::tuple(b.isec, b.sym->value, b.sym->name);
+  });
+  return syms;
+}
+
+static std::span<MapEntry>
+find_symbols(std::span<MapEntry> syms, InputChunk *isec) {
+  auto cmp = [](const MapEntry &a, const MapEntry &b) {
+    return a.isec < b.isec;
+  };
+
+  MapEntry key = {isec, nullptr};
+  auto [begin, end] = std::equal_range(syms.begin(), syms.end(), key, cmp);
+  return {begin, end};
+}
+
+static void write_json_string(std::ostream &out, std::string_view str) {
+  out << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if ((u8)c < 0x20)
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << (u32)c << std::dec << std::setfill(' ');
+    else
+      out << c;
+  }
+  out << '"';
+}
+
+template <typename T>
+static std::string to_string(const T &val) {
+  std::ostringstream ss;
+  ss << val;
+  return ss.str();
+}
+
+static void write_text_header(std::ostream &out, OutputChunk *osec) {
+  out << std::setw(16) << (u64)osec->shdr.sh_addr
+      << std::setw(9) << (u64)osec->shdr.sh_size
+      << std::setw(6) << (u64)osec->shdr.sh_addralign
+      << " " << osec->name << "\n";
+}
+
+static void write_text_member(std::ostream &out, OutputChunk *osec,
+                              InputChunk *mem, std::span<MapEntry> syms) {
+  out << std::setw(16) << (osec->shdr.sh_addr + mem->offset)
+      << std::setw(9) << (u64)mem->shdr.sh_size
+      << std::setw(6) << (u64)mem->shdr.sh_addralign
+      << "         " << *mem << "\n";
+
+  for (MapEntry &ent : syms)
+    out << std::setw(16) << ent.sym->get_addr()
+        << "        0     0                 "
+        << ent.sym->name << "\n";
+}
 
-  for (auto &pair : map) {
-    std::vector<Symbol *> &vec = pair.second;
-    sort(vec, [](Symbol *a, Symbol *b) { return a->value < b->value; });
+static void write_json_header(std::ostream &out, OutputChunk *osec,
+                              bool is_first) {
+  out << (is_first ? "\n" : "]},\n") << "{\"name\":";
+  write_json_string(out, osec->name);
+  out << ",\"addr\":" << osec->shdr.sh_addr
+      << ",\"size\":" << osec->shdr.sh_size
+      << ",\"align\":" << osec->shdr.sh_addralign
+      << ",\"members\":[";
+}
+
+static void write_json_member(std::ostream &out, OutputChunk *osec,
+                              InputChunk *mem, std::span<MapEntry> syms,
+                              bool is_first) {
+  out << (is_first ? "\n" : ",\n") << "{\"file\":";
+  write_json_string(out, to_string(*mem->file));
+  out << ",\"section\":";
+  write_json_string(out, mem->name);
+  out << ",\"addr\":" << (osec->shdr.sh_addr + mem->offset)
+      << ",\"size\":" << mem->shdr.sh_size
+      << ",\"align\":" << mem->shdr.sh_addralign
+      << ",\"symbols\":[";
+
+  for (i64 i = 0; i < syms.size(); i++) {
+    out << (i ? "," : "") << "{\"name\":";
+    write_json_string(out, syms[i].sym->name);
+    out << ",\"addr\":" << syms[i].sym->get_addr() << "}";
+  }
+  out << "]}";
+}
+
+void print_map() {
+  Timer t("print_map");
+
+  std::vector<MapEntry> syms = get_symbols();
+  bool is_json = (config.map_format == MapFormat::JSON);
+
+  // A shard is a range of members of an output section. A shard
+  // starting at member 0 also prints the output section's header.
+  struct Shard {
+    i64 chunk_idx;
+    i64 begin;
+    i64 end;
+  };
+
+  std::vector<Shard> shards;
+  for (i64 i = 0; i < out::chunks.size(); i++) {
+    OutputChunk *chunk = out::chunks[i];
+    i64 num_members = 0;
+    if (chunk->kind == OutputChunk::REGULAR)
+      num_members = ((OutputSection *)chunk)->members.size();
+
+    shards.push_back({i, 0, std::min(num_members, SHARD_SIZE)});
+    for (i64 j = SHARD_SIZE; j < num_members; j += SHARD_SIZE)
+      shards.push_back({i, j, std::min(num_members, j + SHARD_SIZE)});
   }
 
-  std::cout << "             VMA     Size Align Out     In      Symbol\n";
-  for (OutputChunk *osec : out::chunks) {
-    std::cout << std::setw(16) << (u64)osec->shdr.sh_addr
-              << std::setw(9) << (u64)osec->shdr.sh_size
-              << std::setw(6) << (u64)osec->shdr.sh_addralign
-              << " " << osec->name << "\n";
-
-    if (osec->kind != OutputChunk::REGULAR)
-      continue;
-
-    for (InputChunk *mem : ((OutputSection *)osec)->members) {
-      std::cout << std::setw(16) << (osec->shdr.sh_addr + mem->offset)
-                << std::setw(9) << (u64)mem->shdr.sh_size
-                << std::setw(6) << (u64)mem->shdr.sh_addralign
-                << "         " << *mem << "\n";
-
-      auto it = map.find(mem);
-      if (it == map.end())
-        continue;
-
-      std::vector<Symbol *> syms = it->second;
-      for (Symbol *sym : syms)
-        std::cout << std::setw(16) << sym->get_addr()
-                  << "        0     0                 "
-                  << sym->name << "\n";
+  std::vector<std::string> bufs(shards.size());
+
+  tbb::parallel_for((i64)0, (i64)shards.size(), [&](i64 i) {
+    Shard &shard = shards[i];
+    OutputChunk *chunk = out::chunks[shard.chunk_idx];
+    std::ostringstream out;
+
+    if (shard.begin == 0) {
+      if (is_json)
+        write_json_header(out, chunk, shard.chunk_idx == 0);
+      else
+        write_text_header(out, chunk);
     }
+
+    for (i64 j = shard.begin; j < shard.end; j++) {
+      InputChunk *mem = ((OutputSection *)chunk)->members[j];
+      std::span<MapEntry> span = find_symbols(syms, mem);
+      if (is_json)
+        write_json_member(out, chunk, mem, span, j == 0);
+      else
+        write_text_member(out, chunk, mem, span);
+    }
+    bufs[i] = out.str();
+  });
+
+  // Concatenate the buffers.
+  std::string header = is_json ? "{\"output_sections\":[" :
+    "             VMA     Size Align Out     In      Symbol\n";
+  std::string footer = is_json ? (out::chunks.empty() ? "]}\n" : "]}]}\n") : "";
+
+  std::vector<i64> offsets(bufs.size() + 1);
+  offsets[0] = header.size();
+  for (i64 i = 0; i < bufs.size(); i++)
+    offsets[i + 1] = offsets[i] + bufs[i].size();
+
+  std::string contents(offsets.back() + footer.size(), '\0');
+  memcpy(contents.data(), header.data(), header.size());
+  memcpy(contents.data() + offsets.back(), footer.data(), footer.size());
+
+  tbb::parallel_for((i64)0, (i64)bufs.size(), [&](i64 i) {
+    memcpy(contents.data() + offsets[i], bufs[i].data(), bufs[i].size());
+  });
+
+  if (config.map_file.empty()) {
+    std::cout.write(contents.data(), contents.size());
+    std::cout.flush();
+    if (!std::cout)
+      Fatal() << "failed to write a map to stdout";
+    return;
   }
+
+  FILE *fp = fopen(config.map_file.c_str(), "w");
+  if (!fp)
+    Fatal() << "cannot open " << config.map_file << ": " << strerror(errno);
+  if (fwrite(contents.data(), 1, contents.size(), fp) != contents.size())
+    Fatal() << config.map_file << ": " << strerror(errno);
+  if (fclose(fp))
+    Fatal() << config.map_file << ": " << strerror(errno);
 }
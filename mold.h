@@ -11,6 +11,7 @@
 #include <cstdint>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <map>
 #include <mutex>
 #include <set>
@@ -20,11 +21,14 @@
 #include <string_view>
 #include <tbb/concurrent_hash_map.h>
 #include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_do.h>
 #include <tbb/spin_mutex.h>
+#include <tbb/spin_rw_mutex.h>
 #include <vector>
 
 static constexpr i64 SECTOR_SIZE = 512;
 static constexpr i64 PAGE_SIZE = 4096;
+static constexpr i64 HUGE_PAGE_SIZE = 2 * 1024 * 1024;
 static constexpr i64 GOT_SIZE = 8;
 static constexpr i64 PLT_SIZE = 16;
 static constexpr i64 SHA256_SIZE = 32;
@@ -49,12 +53,20 @@ class OutputChunk;
 class OutputSection;
 class SharedFile;
 class Symbol;
+struct SymbolAux;
 
-enum class BuildIdKind : u8 { NONE, MD5, SHA1, SHA256, UUID };
+enum class BuildIdKind : u8 { NONE, MD5, SHA1, SHA256, UUID, FAST };
+enum class IcfHashKind : u8 { FAST, SHA256 };
+enum class CompressKind : u8 { NONE, ZLIB };
+enum class MapFormat : u8 { TEXT, JSON };
 
 struct Config {
   BuildIdKind build_id = BuildIdKind::NONE;
+  IcfHashKind icf_hash = IcfHashKind::FAST;
+  CompressKind compress_debug_sections = CompressKind::NONE;
+  MapFormat map_format = MapFormat::TEXT;
   bool allow_multiple_definition = false;
+  bool call_graph_profile_sort = true;
   bool discard_all = false;
   bool discard_locals = false;
   bool eh_frame_hdr = true;
@@ -64,8 +76,11 @@ struct Config {
   bool hash_style_gnu = false;
   bool hash_style_sysv = true;
   bool icf = false;
+  bool icf_all = false;
+  bool incremental = false;
   bool is_static = false;
   bool perf = false;
+  bool perf_counters = false;
   bool pie = false;
   bool preload = false;
   bool print_gc_sections = false;
@@ -76,13 +91,19 @@ struct Config {
   bool stat = false;
   bool strip_all = false;
   bool trace = false;
+  bool z_hugepage_text = false;
   bool z_now = false;
+  bool z_pack_relative_relocs = false;
   i64 filler = -1;
   i64 thread_count = -1;
+  std::string call_graph_ordering_file;
   std::string dynamic_linker = "/lib64/ld-linux-x86-64.so.2";
   std::string entry = "_start";
+  std::string map_file;
   std::string output;
+  std::string perf_trace;
   std::string rpaths;
+  std::string symbol_ordering_file;
   std::string sysroot;
   std::vector<std::string> globals;
   std::vector<std::string_view> library_paths;
@@ -160,6 +181,73 @@ private:
 
 std::ostream &operator<<(std::ostream &out, const InputFile &file);
 
+//
+// Arena
+//
+
+// A per-thread bump allocator for objects that live until the process
+// exits, such as input sections and other metadata of parsed files.
+// Objects allocated from an arena are never freed individually, and
+// objects allocated by the same thread are adjacent in memory.
+class Arena {
+public:
+  static void *alloc(i64 size, i64 align) {
+    u8 *p = (u8 *)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+    if (p + size > end)
+      return alloc_slow(size, align);
+    cur = p + size;
+    return p;
+  }
+
+  template <typename T, typename... Args>
+  static T *create(Args &&...args) {
+    return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  // Allocates a value-initialized array.
+  template <typename T>
+  static std::span<T> alloc_array(i64 n) {
+    if (n == 0)
+      return {};
+    T *p = (T *)alloc(sizeof(T) * n, alignof(T));
+    std::uninitialized_value_construct_n(p, n);
+    return {p, (size_t)n};
+  }
+
+  template <typename T>
+  static std::span<T> copy(std::span<const T> vec) {
+    if (vec.empty())
+      return {};
+    T *p = (T *)alloc(sizeof(T) * vec.size(), alignof(T));
+    std::uninitialized_copy(vec.begin(), vec.end(), p);
+    return {p, vec.size()};
+  }
+
+  // Gives back the last object created by this thread.
+  template <typename T>
+  static void give_back(T *obj) {
+    assert((u8 *)(obj + 1) == cur);
+    obj->~T();
+    cur = (u8 *)obj;
+  }
+
+private:
+  static constexpr i64 BLOCK_SIZE = 1024 * 1024;
+
+  static void *alloc_slow(i64 size, i64 align) {
+    // Large objects get their own memory.
+    if (size > BLOCK_SIZE / 8)
+      return operator new(size, std::align_val_t(align));
+
+    cur = (u8 *)operator new(BLOCK_SIZE);
+    end = cur + BLOCK_SIZE;
+    return alloc(size, align);
+  }
+
+  static inline thread_local u8 *cur = nullptr;
+  static inline thread_local u8 *end = nullptr;
+};
+
 //
 // Interned string
 //
@@ -176,6 +264,106 @@ template<> struct tbb_hash_compare<std::string_view> {
 };
 }
 
+inline u64 hash_string(std::string_view str) {
+  return std::hash<std::string_view>()(str);
+}
+
+// A concurrent open-addressing hash table of pointers to T. The table
+// is sharded by hash value so that a shard can grow without stopping
+// insertions to other shards. Lookups and insertions take only a
+// shared lock of a shard, and new entries are published with CAS.
+//
+// `HashFn::hash(const T &)` must return the same value as the one
+// passed to insert().
+template <typename T, typename HashFn>
+class ConcurrentTable {
+public:
+  // Returns an existing entry for which `is_equal` returns true, or
+  // inserts a new entry created by `Arena::create<T>(args...)`.
+  template <typename EqFn, typename... Args>
+  T *insert(u64 hash, EqFn is_equal, Args &&...args) {
+    Shard &shard = shards[hash % NUM_SHARDS];
+    T *val = nullptr;
+
+    for (;;) {
+      {
+        tbb::spin_rw_mutex::scoped_lock lock(shard.mu, false);
+
+        // Keep the load factor below 3/4. Many threads can pass this
+        // check at once and fill up the shard, so we probe at most
+        // mask+1 slots and grow the table if all of them are taken.
+        if (shard.size * 4 < shard.mask * 3) {
+          u64 i = (hash / NUM_SHARDS) & shard.mask;
+          for (u64 n = 0; n <= shard.mask; n++, i = (i + 1) & shard.mask) {
+            T *cur = shard.slots[i].load(std::memory_order_acquire);
+
+            if (!cur) {
+              if (!val)
+                val = Arena::create<T>(std::forward<Args>(args)...);
+              if (shard.slots[i].compare_exchange_strong(cur, val,
+                                                         std::memory_order_acq_rel)) {
+                shard.size++;
+                return val;
+              }
+            }
+
+            // Someone else has filled this slot.
+            if (is_equal(*cur)) {
+              if (val)
+                Arena::give_back(val);
+              return cur;
+            }
+          }
+        }
+      }
+
+      grow(shard);
+    }
+  }
+
+  i64 size() const {
+    i64 n = 0;
+    for (const Shard &shard : shards)
+      n += shard.size;
+    return n;
+  }
+
+private:
+  static constexpr i64 NUM_SHARDS = 64;
+
+  struct Shard {
+    std::unique_ptr<std::atomic<T *>[]> slots;
+    u64 mask = 0;
+    std::atomic_int64_t size = 0;
+    tbb::spin_rw_mutex mu;
+  };
+
+  void grow(Shard &shard) {
+    tbb::spin_rw_mutex::scoped_lock lock(shard.mu, true);
+    if (shard.size * 4 < shard.mask * 3)
+      return;
+
+    u64 mask = shard.mask ? shard.mask * 2 + 1 : 255;
+    std::unique_ptr<std::atomic<T *>[]> slots(new std::atomic<T *>[mask + 1]);
+    for (u64 i = 0; i <= mask; i++)
+      slots[i] = nullptr;
+
+    for (u64 i = 0; shard.mask && i <= shard.mask; i++) {
+      if (T *val = shard.slots[i]) {
+        u64 j = (HashFn::hash(*val) / NUM_SHARDS) & mask;
+        while (slots[j])
+          j = (j + 1) & mask;
+        slots[j] = val;
+      }
+    }
+
+    shard.slots = std::move(slots);
+    shard.mask = mask;
+  }
+
+  Shard shards[NUM_SHARDS];
+};
+
 template<typename ValueT> class ConcurrentMap {
 public:
   ValueT *insert(std::string_view key, const ValueT &val) {
@@ -187,15 +375,48 @@ public:
   tbb::concurrent_hash_map<std::string_view, ValueT> map;
 };
 
+// StringTable builds a string table such as .dynstr or .strtab.
+// Strings can be added concurrently. finalize() assigns offsets to
+// them, and a string that is a suffix of another string shares the
+// other string's bytes (e.g. "bar" is placed at the end of "foobar").
+class StringTable {
+public:
+  void add(std::string_view str) {
+    assert(size == -1);
+    if (!str.empty())
+      map.insert(std::make_pair(str, 0));
+  }
+
+  i64 find(std::string_view str) {
+    if (str.empty())
+      return 0;
+    decltype(map)::const_accessor acc;
+    bool found = map.find(acc, str);
+    assert(found);
+    return acc->second;
+  }
+
+  i64 finalize();
+  void write(u8 *buf);
+
+private:
+  tbb::concurrent_hash_map<std::string_view, i64> map;
+  std::vector<std::pair<std::string_view, i64>> strings;
+  std::vector<u8> is_suffix;
+  i64 size = -1;
+};
+
 //
 // Symbol
 //
 
 struct SectionFragment {
-  SectionFragment(std::string_view data) : data(data) {}
+  SectionFragment(std::string_view data, u16 alignment)
+    : data(data), alignment(alignment) {}
 
   SectionFragment(const SectionFragment &other)
-    : isec(other.isec.load()), data(other.data), offset(other.offset) {}
+    : isec(other.isec.load()), data(other.data), offset(other.offset),
+      alignment(other.alignment) {}
 
   inline u64 get_addr() const;
 
@@ -206,27 +427,20 @@ struct SectionFragment {
   std::atomic_bool is_alive = !config.gc_sections;
 };
 
-struct SectionFragmentRef {
-  SectionFragment *frag = nullptr;
-  i32 addend = 0;
-};
-
-struct SectionFragmentKey {
-  std::string_view data;
-  u32 alignment;
-};
+inline u64 hash_fragment(std::string_view data, u32 alignment) {
+  return hash_string(data) ^ (alignment * 0x9e3779b97f4a7c15);
+}
 
-namespace tbb {
-template<> struct tbb_hash_compare<SectionFragmentKey> {
-  static size_t hash(const SectionFragmentKey &k) {
-    return std::hash<std::string_view>()(k.data) ^ std::hash<u32>()(k.alignment);
+struct FragmentHash {
+  static u64 hash(const SectionFragment &frag) {
+    return hash_fragment(frag.data, frag.alignment);
   }
+};
 
-  static bool equal(const SectionFragmentKey &k1, const SectionFragmentKey &k2) {
-    return k1.data == k2.data && k1.alignment == k2.alignment;
-  }
+struct SectionFragmentRef {
+  SectionFragment *frag = nullptr;
+  i32 addend = 0;
 };
-}
 
 enum {
   NEEDS_GOT      = 1 << 0,
@@ -238,15 +452,30 @@ enum {
   NEEDS_DYNSYM   = 1 << 6,
 };
 
+static constexpr u64 UNRESOLVED_RANK = (u64)4 << 32;
+
+// Indices of a symbol in linker-synthesized tables such as GOT or PLT.
+// Only a small fraction of symbols need them, so they are kept in a
+// side table instead of in Symbol.
+struct SymbolAux {
+  u32 got_idx = -1;
+  u32 gotplt_idx = -1;
+  u32 gottpoff_idx = -1;
+  u32 tlsgd_idx = -1;
+  u32 plt_idx = -1;
+  u32 dynsym_idx = -1;
+};
+
 class Symbol {
 public:
   Symbol() = default;
   Symbol(std::string_view name) : name(name) {}
   Symbol(const Symbol &other) : name(other.name) {}
 
+  static Symbol *intern(std::string_view name, u64 hash);
+
   static Symbol *intern(std::string_view name) {
-    static ConcurrentMap<Symbol> map;
-    return map.insert(name, {name});
+    return intern(name, hash_string(name));
   }
 
   inline u64 get_addr() const;
@@ -256,6 +485,14 @@ public:
   inline u64 get_tlsgd_addr() const;
   inline u64 get_plt_addr() const;
 
+  inline u32 get_got_idx() const;
+  inline u32 get_gotplt_idx() const;
+  inline u32 get_gottpoff_idx() const;
+  inline u32 get_tlsgd_idx() const;
+  inline u32 get_plt_idx() const;
+  inline u32 get_dynsym_idx() const;
+  inline SymbolAux &aux();
+
   inline bool is_alive() const;
   inline bool is_absolute() const;
   inline bool is_relative() const { return !is_absolute(); }
@@ -267,20 +504,17 @@ public:
   SectionFragment *frag = nullptr;
 
   u64 value = -1;
-  u32 got_idx = -1;
-  u32 gotplt_idx = -1;
-  u32 gottpoff_idx = -1;
-  u32 tlsgd_idx = -1;
-  u32 plt_idx = -1;
-  u32 dynsym_idx = -1;
+  i32 aux_idx = -1;
   u16 shndx = 0;
   u16 ver_idx = 0;
 
+  // Symbol resolution picks the definition with the smallest rank.
+  // See get_rank() in object_file.cc.
+  std::atomic_uint64_t rank = UNRESOLVED_RANK;
+
   std::atomic_uint8_t flags = 0;
   u8 st_type = STT_NOTYPE;
 
-  tbb::spin_mutex mu;
-
   u8 is_placeholder : 1 = false;
   u8 is_imported : 1 = false;
   u8 is_weak : 1 = false;
@@ -291,6 +525,19 @@ public:
   u8 has_copyrel : 1 = false;
 };
 
+struct SymbolHash {
+  static u64 hash(const Symbol &sym) { return hash_string(sym.name); }
+};
+
+// Global symbols are interned to a hash table and are allocated from
+// per-thread arenas, so that symbols of the same file tend to be
+// adjacent in memory. `hash` must be hash_string(name).
+inline Symbol *Symbol::intern(std::string_view name, u64 hash) {
+  static ConcurrentTable<Symbol, SymbolHash> table;
+  auto is_equal = [&](const Symbol &sym) { return sym.name == name; };
+  return table.insert(hash, is_equal, name);
+}
+
 //
 // input_sections.cc
 //
@@ -310,14 +557,23 @@ public:
   std::string_view name;
   u32 offset;
 
+  // Contents of an SHF_COMPRESSED section excluding the header. They
+  // are decompressed when get_contents() is called for the first time.
+  std::string_view compressed;
+
 protected:
   InputChunk(ObjectFile *file, const ElfShdr &shdr, std::string_view name);
+
+private:
+  mutable std::once_flag decompress_once;
+  mutable std::string_view decompressed;
 };
 
 enum RelType : u8 {
   R_NONE = 1,
   R_ABS,
   R_ABS_DYN,
+  R_ABS_RELR,
   R_DYN,
   R_PC,
   R_GOT,
@@ -347,17 +603,16 @@ inline bool operator==(const EhReloc &a, const EhReloc &b) {
 struct CieRecord;
 
 struct FdeRecord {
-  FdeRecord(std::string_view contents, std::vector<EhReloc> &&rels,
-            u32 cie_idx)
-    : contents(contents), rels(std::move(rels)), cie_idx(cie_idx) {}
+  FdeRecord(std::string_view contents, std::span<EhReloc> rels, u32 cie_idx)
+    : contents(contents), rels(rels), cie_idx(cie_idx) {}
 
   FdeRecord(const FdeRecord &&other)
-    : contents(other.contents), rels(std::move(other.rels)),
+    : contents(other.contents), rels(other.rels),
       cie_idx(other.cie_idx), offset(other.offset),
       is_alive(other.is_alive.load()) {}
 
   std::string_view contents;
-  std::vector<EhReloc> rels;
+  std::span<EhReloc> rels;
   u32 cie_idx = -1;
   u32 offset = -1;
   std::atomic_bool is_alive = true;
@@ -367,7 +622,7 @@ struct CieRecord {
   bool should_merge(const CieRecord &other) const;
 
   std::string_view contents;
-  std::vector<EhReloc> rels;
+  std::span<EhReloc> rels;
   std::vector<FdeRecord> fdes;
 
   // For .eh_frame
@@ -380,23 +635,44 @@ struct CieRecord {
   u32 fde_idx = -1;
 };
 
+// An index entry to find a CIE or FDE record by its input section
+// and address. fde_idx is -1 for a CIE.
+struct EhFrameRef {
+  u32 shndx;
+  const char *begin;
+  u32 cie_idx;
+  i32 fde_idx;
+};
+
 class InputSection : public InputChunk {
 public:
   InputSection(ObjectFile *file, const ElfShdr &shdr, std::string_view name)
     : InputChunk(file, shdr, name) {}
 
   void copy_buf() override;
+  void write_to(u8 *base);
   void scan_relocations();
   void report_undefined_symbols();
   void apply_reloc_alloc(u8 *base);
+  void apply_reloc_nonalloc(u8 *base, i64 begin, i64 end, i64 ref_idx);
+  void create_reloc_plan();
   void apply_reloc_nonalloc(u8 *base);
 
   std::span<ElfRela> rels;
-  std::vector<bool> has_fragments;
-  std::vector<SectionFragmentRef> rel_fragments;
-  std::vector<RelType> rel_types;
+  std::span<bool> has_fragments;
+  std::span<SectionFragmentRef> rel_fragments;
+  std::span<RelType> rel_types;
+
+  // Indices of relocations grouped by how they are applied. The first
+  // num_pc32_rels are R_PC with a 32-bit field, and the next
+  // num_abs64_rels are R_ABS with a 64-bit field. The rest are applied
+  // by the generic code in input order. See apply_reloc_alloc().
+  std::span<u32> rel_plan;
+  u32 num_pc32_rels = 0;
+  u32 num_abs64_rels = 0;
   std::span<FdeRecord> fdes;
   u64 reldyn_offset = 0;
+  u32 slack = 0;
   bool is_comdat_member = false;
   bool is_ehframe = false;
 
@@ -409,6 +685,15 @@ public:
   // For ICF
   InputSection *leader = nullptr;
   u32 icf_idx = -1;
+  std::atomic_bool is_addrsig = false;
+
+  // For section ordering. Sections with smaller values come first
+  // in an output section. Unordered sections have 0.
+  i32 order = 0;
+
+  // For --incremental. True if the existing output file already has
+  // this section's contents at the right place.
+  bool is_unchanged = false;
 };
 
 class MergeableSection : public InputChunk {
@@ -433,6 +718,10 @@ public:
   virtual void copy_buf() {}
   virtual void update_shdr() {}
 
+  // Writes contents to a given buffer instead of the output file.
+  // Only sections that can be compressed implement this.
+  virtual void write_to(u8 *buf) { unreachable(); }
+
   std::string_view name;
   i64 shndx = 0;
   Kind kind;
@@ -503,6 +792,7 @@ public:
   }
 
   void copy_buf() override;
+  void write_to(u8 *buf) override;
 
   static inline std::vector<OutputSection *> instances;
 
@@ -594,6 +884,28 @@ public:
   void copy_buf() override;
 };
 
+// .relr.dyn contains R_X86_64_RELATIVE relocations in the compact
+// RELR format. Each entry is either an address to relocate or a bitmap
+// of the next 63 words to relocate.
+class RelrDynSection : public OutputChunk {
+public:
+  RelrDynSection() : OutputChunk(SYNTHETIC) {
+    name = ".relr.dyn";
+    shdr.sh_type = SHT_RELR;
+    shdr.sh_flags = SHF_ALLOC;
+    shdr.sh_entsize = 8;
+    shdr.sh_addralign = 8;
+  }
+
+  void construct();
+  void copy_buf() override;
+
+private:
+  // Encoded entries for each output chunk. Addresses are relative to
+  // the beginning of the chunk until they are written to the file.
+  std::vector<std::pair<OutputChunk *, std::vector<u64>>> contents;
+};
+
 class StrtabSection : public OutputChunk {
 public:
   StrtabSection() : OutputChunk(SYNTHETIC) {
@@ -602,7 +914,13 @@ public:
     shdr.sh_size = 1;
   }
 
+  void add_string(std::string_view str) { strtab.add(str); }
+  i64 find_string(std::string_view str) { return strtab.find(str); }
   void update_shdr() override;
+  void copy_buf() override;
+
+private:
+  StringTable strtab;
 };
 
 class ShstrtabSection : public OutputChunk {
@@ -625,12 +943,13 @@ DynstrSection() : OutputChunk(SYNTHETIC) {
     shdr.sh_size = 1;
   }
 
-  i64 add_string(std::string_view str);
-  i64 find_string(std::string_view str);
+  void add_string(std::string_view str) { strtab.add(str); }
+  i64 find_string(std::string_view str) { return strtab.find(str); }
+  void finalize();
   void copy_buf() override;
 
 private:
-  std::unordered_map<std::string_view, i64> strings;
+  StringTable strtab;
 };
 
 class DynamicSection : public OutputChunk {
@@ -678,7 +997,10 @@ public:
   void copy_buf() override;
 
   std::vector<Symbol *> symbols = {nullptr};
-  std::vector<u32> name_indices = {(u32)-1};
+
+  // GNU hash values of symbol names. Only the values for symbols
+  // covered by .gnu.hash (i.e. from out::gnu_hash->symoffset) are set.
+  std::vector<u32> hashes;
 };
 
 class HashSection : public OutputChunk {
@@ -723,14 +1045,13 @@ public:
 
   static inline std::vector<MergedSection *> instances;
 
-  SectionFragment *insert(std::string_view data, u32 alignment) {
-    typename decltype(map)::const_accessor acc;
-    map.insert(acc, std::pair(SectionFragmentKey{data, alignment},
-                              SectionFragment(data)));
-    return const_cast<SectionFragment *>(&acc->second);
-  }
+  SectionFragment *insert(std::string_view data, u64 hash, u32 alignment);
 
   void copy_buf() override;
+  void write_to(u8 *buf) override;
+
+  std::vector<MergeableSection *> members;
+  u32 idx;
 
 private:
   MergedSection(std::string_view name, u64 flags, u32 type)
@@ -738,9 +1059,11 @@ private:
     this->name = name;
     shdr.sh_flags = flags;
     shdr.sh_type = type;
+    idx = instances.size();
+    instances.push_back(this);
   }
 
-  tbb::concurrent_hash_map<SectionFragmentKey, SectionFragment> map;
+  ConcurrentTable<SectionFragment, FragmentHash> map;
 };
 
 class EhFrameSection : public OutputChunk {
@@ -830,9 +1153,35 @@ public:
 
   void update_shdr() override;
   void copy_buf() override;
-  void write_buildid(i64 filesize);
+
+  void start_hashing(i64 filesize);
+  void chunk_written(i64 idx);
+  void write_buildid();
 
   static constexpr i64 HEADER_SIZE = 16;
+
+private:
+  std::vector<std::pair<i64, i64>> get_shards_for(i64 idx);
+  void hash_shard(i64 shard);
+
+  i64 filesize = 0;
+  i64 digest_size = 0;
+  std::vector<std::pair<i64, i64>> extents;
+  std::unique_ptr<std::atomic_int32_t[]> refcounts;
+  std::vector<u8> digests;
+};
+
+// A non-alloc section whose contents are compressed before being
+// written to the output file.
+class CompressedSection final : public OutputChunk {
+public:
+  CompressedSection(OutputChunk &chunk);
+  void copy_buf() override;
+
+private:
+  ElfChdr chdr = {};
+  std::vector<std::vector<u8>> shards;
+  u32 checksum = 1;
 };
 
 bool is_c_identifier(std::string_view name);
@@ -855,6 +1204,7 @@ class MemoryMappedFile {
 public:
   static MemoryMappedFile *open(std::string path);
   static MemoryMappedFile *must_open(std::string path);
+  static void prefetch(std::vector<std::string> paths);
 
   MemoryMappedFile(std::string name, u8 *data, u64 size, u64 mtime = 0)
     : name(name), data_(data), size_(size), mtime(mtime) {}
@@ -864,6 +1214,7 @@ public:
 
   u8 *data();
   i64 size() const { return size_; }
+  void advise();
 
   std::string_view get_contents() {
     return std::string_view((char *)data(), size());
@@ -906,13 +1257,15 @@ protected:
 
 class ObjectFile : public InputFile {
 public:
-  ObjectFile(MemoryMappedFile *mb, std::string archive_name);
+  ObjectFile(MemoryMappedFile *mb, std::string archive_name,
+             std::vector<std::string_view> lazy_symbols = {});
   ObjectFile();
 
   void parse();
   void resolve_symbols();
-  void mark_live_objects(std::function<void(ObjectFile *)> feeder);
+  void mark_live_objects(tbb::parallel_do_feeder<ObjectFile *> &feeder);
   void handle_undefined_weak_symbols();
+  void claim_resolved_symbols();
   void resolve_comdat_groups();
   void eliminate_duplicate_comdat_groups();
   void scan_relocations();
@@ -920,6 +1273,7 @@ public:
   void compute_symtab();
   void write_symtab();
   void kill(i64 shndx);
+  std::span<u64> get_local_addrs();
 
   static ObjectFile *create_internal_file();
 
@@ -929,6 +1283,13 @@ public:
   i64 first_global = 0;
   const bool is_in_archive = false;
   std::vector<CieRecord> cies;
+  std::vector<EhFrameRef> ehframe_index;
+
+  // An archive member is not parsed until it is pulled out for the
+  // first time. Until then, we know only the symbol names listed in
+  // the archive symbol table.
+  bool is_lazy = false;
+  std::vector<std::string_view> lazy_symbols;
 
   u64 num_dynrel = 0;
   u64 reldyn_offset = 0;
@@ -937,17 +1298,26 @@ public:
   u64 global_symtab_offset = 0;
   u64 num_local_symtab = 0;
   u64 num_global_symtab = 0;
-  u64 strtab_offset = 0;
-  u64 strtab_size = 0;
 
   std::vector<MergeableSection *> mergeable_sections;
 
+  // Contents of .llvm.call-graph-profile. The i'th weight is for an
+  // edge from the symbol of the (2*i)'th relocation to the (2*i+1)'th.
+  std::span<u64> cg_profile_weights;
+  std::span<ElfRel> cg_profile_rels;
+
+  // .llvm_addrsig, a list of ULEB128-encoded indices of symbols whose
+  // addresses are significant. Null if the file doesn't have one.
+  const ElfShdr *addrsig_sec = nullptr;
+
 private:
   void initialize_sections();
   void initialize_symbols();
   void initialize_mergeable_sections();
   void initialize_ehframe_sections();
   void read_ehframe(InputSection &isec);
+  template <typename Fn> void for_each_index(i64 n, Fn fn);
+  InputSection *get_section(const ElfSym &esym);
   void maybe_override_symbol(Symbol &sym, i64 symidx);
 
   std::vector<std::pair<ComdatGroup *, std::span<u32>>> comdat_groups;
@@ -956,6 +1326,9 @@ private:
 
   std::string_view symbol_strtab;
   const ElfShdr *symtab_sec;
+
+  std::once_flag local_addrs_once;
+  std::vector<u64> local_addrs;
 };
 
 class SharedFile : public InputFile {
@@ -966,6 +1339,7 @@ public:
 
   void parse();
   void resolve_symbols();
+  void claim_resolved_symbols();
   std::span<Symbol *> find_aliases(Symbol *sym);
 
   std::string_view soname;
@@ -992,6 +1366,8 @@ inline std::ostream &operator<<(std::ostream &out, const InputChunk &isec) {
 //
 
 std::vector<MemoryMappedFile *> read_archive_members(MemoryMappedFile *mb);
+std::vector<std::vector<std::string_view>>
+read_archive_symtab(MemoryMappedFile *mb);
 std::vector<MemoryMappedFile *> read_fat_archive_members(MemoryMappedFile *mb);
 std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb);
 
@@ -1012,6 +1388,7 @@ public:
   virtual void close() = 0;
 
   u8 *buf;
+  bool has_old_contents = false;
   static inline char *tmpfile;
 
 protected:
@@ -1042,6 +1419,7 @@ public:
   static inline bool enabled = false;
 
 private:
+  friend void write_perf_trace(std::string path);
   i64 get_value();
 
   std::string_view name;
@@ -1050,6 +1428,21 @@ private:
   static inline std::vector<Counter *> instances;
 };
 
+// Hardware and memory statistics sampled at the start and the end of
+// each timer if --perf-counters is given.
+struct PerfCounters {
+  static constexpr i64 NUM_EVENTS = 5;
+
+  static void start();
+  static inline bool enabled = false;
+
+  void read();
+
+  i64 events[NUM_EVENTS]; // cycles, insns, LLC misses, dTLB misses, faults
+  i64 rss = 0;
+  i64 committed = -1;
+};
+
 struct TimerRecord {
   TimerRecord(std::string name);
   void stop();
@@ -1059,6 +1452,8 @@ struct TimerRecord {
   i64 end;
   i64 user;
   i64 sys;
+  PerfCounters counters_start;
+  PerfCounters counters_end;
   bool stopped = false;
 };
 
@@ -1070,10 +1465,63 @@ public:
   static void print();
 
 private:
+  friend void write_perf_trace(std::string path);
   static inline std::vector<TimerRecord *> records;
   TimerRecord *record;
 };
 
+// Measures how long it takes to parse an input file. --perf shows
+// the slowest files, and --perf-trace shows all of them.
+class ParseTimer {
+public:
+  ParseTimer(InputFile *file);
+  ~ParseTimer();
+  static void print();
+
+private:
+  friend void write_perf_trace(std::string path);
+
+  struct Record {
+    InputFile *file;
+    i64 tid;
+    i64 start;
+    i64 end;
+  };
+
+  static inline std::mutex mu;
+  static inline std::vector<Record> records;
+  InputFile *file;
+  i64 start;
+};
+
+void start_perf_trace();
+void write_perf_trace(std::string path);
+
+//
+// hash.cc
+//
+
+class Hash128 {
+public:
+  static constexpr i64 HASH_SIZE = 16;
+
+  Hash128(u64 seed = 0) : h1(seed), h2(seed) {}
+
+  void update(const void *data, i64 size);
+  void finish(u8 *out);
+
+private:
+  static constexpr i64 BLOCK_SIZE = 16;
+
+  void mix(const u8 *block);
+
+  u64 h1;
+  u64 h2;
+  u64 len = 0;
+  u8 buf[BLOCK_SIZE];
+  i64 buf_size = 0;
+};
+
 //
 // gc_sections.cc
 //
@@ -1092,6 +1540,20 @@ void icf_sections();
 
 void icf_sections();
 
+//
+// section_order.cc
+//
+
+void order_sections();
+
+//
+// incremental.cc
+//
+
+void prepare_incremental_link(std::span<std::string_view> args);
+void reuse_previous_output(OutputFile *file);
+void write_incremental_state(i64 filesize);
+
 //
 // mapfile.cc
 //
@@ -1106,8 +1568,8 @@ inline char *socket_tmpfile;
 
 std::function<void()> fork_child();
 bool resume_daemon(char **argv, i64 *code);
-void daemonize(char **argv, std::function<void()> *wait_for_client,
-               std::function<void()> *on_complete);
+char **daemonize(std::function<void()> preload,
+                 std::function<void()> *on_complete);
 
 //
 // main.cc
@@ -1127,6 +1589,8 @@ inline std::vector<OutputChunk *> chunks;
 inline u8 *buf;
 
 inline ObjectFile *internal_file;
+inline std::vector<InputFile *> files_by_priority;
+inline std::vector<SymbolAux> symbol_aux;
 
 inline OutputEhdr *ehdr;
 inline OutputShdr *shdr;
@@ -1136,6 +1600,7 @@ inline GotSection *got;
 inline GotPltSection *gotplt;
 inline RelPltSection *relplt;
 inline RelDynSection *reldyn;
+inline RelrDynSection *relrdyn;
 inline DynamicSection *dynamic;
 inline StrtabSection *strtab;
 inline DynstrSection *dynstr;
@@ -1238,28 +1703,62 @@ inline u64 Symbol::get_addr() const {
 }
 
 inline u64 Symbol::get_got_addr() const {
-  assert(got_idx != -1);
-  return out::got->shdr.sh_addr + got_idx * GOT_SIZE;
+  assert(get_got_idx() != -1);
+  return out::got->shdr.sh_addr + get_got_idx() * GOT_SIZE;
 }
 
 inline u64 Symbol::get_gotplt_addr() const {
-  assert(gotplt_idx != -1);
-  return out::gotplt->shdr.sh_addr + gotplt_idx * GOT_SIZE;
+  assert(get_gotplt_idx() != -1);
+  return out::gotplt->shdr.sh_addr + get_gotplt_idx() * GOT_SIZE;
 }
 
 inline u64 Symbol::get_gottpoff_addr() const {
-  assert(gottpoff_idx != -1);
-  return out::got->shdr.sh_addr + gottpoff_idx * GOT_SIZE;
+  assert(get_gottpoff_idx() != -1);
+  return out::got->shdr.sh_addr + get_gottpoff_idx() * GOT_SIZE;
 }
 
 inline u64 Symbol::get_tlsgd_addr() const {
-  assert(tlsgd_idx != -1);
-  return out::got->shdr.sh_addr + tlsgd_idx * GOT_SIZE;
+  assert(get_tlsgd_idx() != -1);
+  return out::got->shdr.sh_addr + get_tlsgd_idx() * GOT_SIZE;
 }
 
 inline u64 Symbol::get_plt_addr() const {
-  assert(plt_idx != -1);
-  return out::plt->shdr.sh_addr + plt_idx * PLT_SIZE;
+  assert(get_plt_idx() != -1);
+  return out::plt->shdr.sh_addr + get_plt_idx() * PLT_SIZE;
+}
+
+inline u32 Symbol::get_got_idx() const {
+  return (aux_idx == -1) ? -1 : out::symbol_aux[aux_idx].got_idx;
+}
+
+inline u32 Symbol::get_gotplt_idx() const {
+  return (aux_idx == -1) ? -1 : out::symbol_aux[aux_idx].gotplt_idx;
+}
+
+inline u32 Symbol::get_gottpoff_idx() const {
+  return (aux_idx == -1) ? -1 : out::symbol_aux[aux_idx].gottpoff_idx;
+}
+
+inline u32 Symbol::get_tlsgd_idx() const {
+  return (aux_idx == -1) ? -1 : out::symbol_aux[aux_idx].tlsgd_idx;
+}
+
+inline u32 Symbol::get_plt_idx() const {
+  return (aux_idx == -1) ? -1 : out::symbol_aux[aux_idx].plt_idx;
+}
+
+inline u32 Symbol::get_dynsym_idx() const {
+  return (aux_idx == -1) ? -1 : out::symbol_aux[aux_idx].dynsym_idx;
+}
+
+// Returns this symbol's entry in the side table, creating it if it
+// doesn't exist. This function is not thread-safe.
+inline SymbolAux &Symbol::aux() {
+  if (aux_idx == -1) {
+    aux_idx = out::symbol_aux.size();
+    out::symbol_aux.push_back({});
+  }
+  return out::symbol_aux[aux_idx];
 }
 
 inline u64 SectionFragment::get_addr() const {
@@ -6,6 +6,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <tbb/parallel_for.h>
+#include <thread>
 #include <unistd.h>
 
 MemoryMappedFile *MemoryMappedFile::open(std::string path) {
@@ -22,6 +24,39 @@ MemoryMappedFile *MemoryMappedFile::must_open(std::string path) {
   Fatal() << "cannot open " << path;
 }
 
+// Asks the kernel to read files into the page cache in a background
+// thread. On cold caches, this lets I/O overlap with other work instead
+// of stalling parse threads on page faults one file at a time.
+void MemoryMappedFile::prefetch(std::vector<std::string> paths) {
+  if (paths.empty())
+    return;
+
+  std::thread([paths = std::move(paths)]() {
+    for (const std::string &path : paths) {
+      i64 fd = ::open(path.c_str(), O_RDONLY);
+      if (fd == -1)
+        continue;
+
+      // Only some members of an archive are usually needed, and they
+      // are advised individually when they are parsed.
+      char magic[8];
+      if (pread(fd, magic, sizeof(magic), 0) != sizeof(magic) ||
+          (memcmp(magic, "!<arch>\n", 8) && memcmp(magic, "!<thin>\n", 8)))
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      close(fd);
+    }
+  }).detach();
+}
+
+// Lets the kernel read ahead the file or an archive member as a whole
+// instead of faulting pages in one by one. This is called when we are
+// about to read the entire contents.
+void MemoryMappedFile::advise() {
+  u64 begin = (u64)data() & ~(u64)(PAGE_SIZE - 1);
+  u64 end = (u64)data() + size_;
+  madvise((void *)begin, end - begin, MADV_WILLNEED);
+}
+
 u8 *MemoryMappedFile::data() {
   if (data_)
     return data_;
@@ -34,15 +69,16 @@ u8 *MemoryMappedFile::data() {
   if (fd == -1)
     Fatal() << name << ": cannot open: " << strerror(errno);
 
-  data_ = (u8 *)mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (data_ == MAP_FAILED)
+  u8 *buf = (u8 *)mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (buf == MAP_FAILED)
     Fatal() << name << ": mmap failed: " << strerror(errno);
   close(fd);
+  data_ = buf;
   return data_;
 }
 
 MemoryMappedFile *MemoryMappedFile::slice(std::string name, u64 start, u64 size) {
-  MemoryMappedFile *mb = new MemoryMappedFile(name, data_ + start, size);
+  MemoryMappedFile *mb = new MemoryMappedFile(name, data_ + start, size, mtime);
   mb->parent = this;
   return mb;
 }
@@ -101,16 +137,41 @@ ElfShdr *InputFile::find_section(i64 type) {
   return nullptr;
 }
 
-ObjectFile::ObjectFile(MemoryMappedFile *mb, std::string archive_name)
+ObjectFile::ObjectFile(MemoryMappedFile *mb, std::string archive_name,
+                       std::vector<std::string_view> lazy_symbols)
   : InputFile(mb), archive_name(archive_name),
-    is_in_archive(archive_name != "") {
+    is_in_archive(archive_name != ""), lazy_symbols(lazy_symbols) {
   is_alive = (archive_name == "");
+  is_lazy = !this->lazy_symbols.empty();
 }
 
 void ObjectFile::initialize_sections() {
+  // Section headers of compressed sections describe compressed data.
+  // We want the rest of the linker to see the uncompressed size and
+  // alignment, so we rewrite them in a private copy of the headers.
+  for (const ElfShdr &shdr : elf_sections) {
+    if (shdr.sh_flags & SHF_COMPRESSED) {
+      elf_sections = Arena::copy<ElfShdr>(elf_sections);
+      break;
+    }
+  }
+
   // Read sections
   for (i64 i = 0; i < elf_sections.size(); i++) {
-    const ElfShdr &shdr = elf_sections[i];
+    ElfShdr &shdr = elf_sections[i];
+
+    if (shdr.sh_type == SHT_LLVM_CALL_GRAPH_PROFILE) {
+      cg_profile_weights = get_data<u64>(shdr);
+      continue;
+    }
+
+    // Tools that don't know .llvm_addrsig, such as `ld -r`, clear
+    // its sh_link. Its contents can't be trusted in that case.
+    if (shdr.sh_type == SHT_LLVM_ADDRSIG) {
+      if (shdr.sh_link)
+        addrsig_sec = &shdr;
+      continue;
+    }
 
     if ((shdr.sh_flags & SHF_EXCLUDE) && !(shdr.sh_flags & SHF_ALLOC))
       continue;
@@ -155,7 +216,26 @@ void ObjectFile::initialize_sections() {
       counter.inc();
 
       std::string_view name = shstrtab.data() + shdr.sh_name;
-      this->sections[i] = new InputSection(this, shdr, name);
+      std::string_view compressed;
+
+      if (shdr.sh_flags & SHF_COMPRESSED) {
+        std::string_view data = get_string(shdr);
+        if (data.size() < sizeof(ElfChdr))
+          Fatal() << *this << ": " << name << ": corrupted compressed section";
+
+        ElfChdr &chdr = *(ElfChdr *)data.data();
+        if (chdr.ch_type != ELFCOMPRESS_ZLIB)
+          Fatal() << *this << ": " << name << ": unsupported compression type: "
+                  << chdr.ch_type;
+
+        compressed = data.substr(sizeof(ElfChdr));
+        shdr.sh_flags &= ~(u64)SHF_COMPRESSED;
+        shdr.sh_size = chdr.ch_size;
+        shdr.sh_addralign = chdr.ch_addralign;
+      }
+
+      this->sections[i] = Arena::create<InputSection>(this, shdr, name);
+      this->sections[i]->compressed = compressed;
       break;
     }
     }
@@ -163,16 +243,23 @@ void ObjectFile::initialize_sections() {
 
   // Attach relocation sections to their target sections.
   for (const ElfShdr &shdr : elf_sections) {
-    if (shdr.sh_type != SHT_RELA)
+    if (shdr.sh_type != SHT_RELA && shdr.sh_type != SHT_REL)
       continue;
 
     if (shdr.sh_info >= sections.size())
       Fatal() << *this << ": invalid relocated section index: "
               << (u32)shdr.sh_info;
 
+    // SHT_REL is used only for .llvm.call-graph-profile.
+    if (shdr.sh_type == SHT_REL) {
+      if (elf_sections[shdr.sh_info].sh_type == SHT_LLVM_CALL_GRAPH_PROFILE)
+        cg_profile_rels = get_data<ElfRel>(shdr);
+      continue;
+    }
+
     if (InputSection *target = sections[shdr.sh_info]) {
       target->rels = get_data<ElfRela>(shdr);
-      target->has_fragments.resize(target->rels.size());
+      target->has_fragments = Arena::alloc_array<bool>(target->rels.size());
     }
   }
 
@@ -194,6 +281,14 @@ void ObjectFile::initialize_ehframe_sections() {
       sections[i] = nullptr;
     }
   }
+
+  // Records are in input order within each section, but a file may
+  // contain more than one .eh_frame section. An empty section begins
+  // at the same address as the next one, so sections are compared
+  // first.
+  sort(ehframe_index, [](const EhFrameRef &a, const EhFrameRef &b) {
+    return std::tuple(a.shndx, a.begin) < std::tuple(b.shndx, b.begin);
+  });
 }
 
 // .eh_frame contains data records explaining how to handle exceptions.
@@ -229,8 +324,10 @@ void ObjectFile::read_ehframe(InputSection &isec) {
   std::span<ElfRela> rels = isec.rels;
   std::string_view data = get_string(isec.shdr);
   const char *begin = data.data();
+  u32 shndx = isec.get_section_idx();
 
   if (data.empty()) {
+    ehframe_index.push_back({shndx, data.data(), (u32)cies.size(), -1});
     cies.push_back(CieRecord{data});
     return;
   }
@@ -248,6 +345,7 @@ void ObjectFile::read_ehframe(InputSection &isec) {
     if (size == 0) {
       if (data.size() != 4)
         Fatal() << isec << ": garbage at end of section";
+      ehframe_index.push_back({shndx, data.data(), (u32)cies.size(), -1});
       cies.push_back(CieRecord{data});
       return;
     }
@@ -278,7 +376,8 @@ void ObjectFile::read_ehframe(InputSection &isec) {
       // CIE
       cur_cie = cies.size();
       offset_to_cie[begin_offset] = cies.size();
-      cies.push_back(CieRecord{contents, std::move(eh_rels)});
+      ehframe_index.push_back({shndx, contents.data(), (u32)cur_cie, -1});
+      cies.push_back(CieRecord{contents, Arena::copy<EhReloc>(eh_rels)});
     } else {
       // FDE
       i64 cie_offset = begin_offset + 4 - id;
@@ -295,7 +394,9 @@ void ObjectFile::read_ehframe(InputSection &isec) {
       if (eh_rels[0].offset != 8)
         Fatal() << isec << ": FDE's first relocation should have offset 8";
 
-      FdeRecord fde(contents, std::move(eh_rels), cur_cie);
+      ehframe_index.push_back({shndx, contents.data(), (u32)cur_cie,
+                               (i32)cies[cur_cie].fdes.size()});
+      FdeRecord fde(contents, Arena::copy<EhReloc>(eh_rels), cur_cie);
       cies[cur_cie].fdes.push_back(std::move(fde));
     }
   }
@@ -345,7 +446,7 @@ void ObjectFile::initialize_symbols() {
   counter.inc(elf_syms.size());
 
   // Initialize local symbols
-  Symbol *locals = new Symbol[first_global];
+  Symbol *locals = Arena::alloc_array<Symbol>(first_global).data();
 
   for (i64 i = 1; i < first_global; i++) {
     const ElfSym &esym = elf_syms[i];
@@ -365,7 +466,6 @@ void ObjectFile::initialize_symbols() {
 
     if (should_write_symtab(sym)) {
       sym.write_symtab = true;
-      strtab_size += sym.name.size() + 1;
       num_local_symtab++;
     }
   }
@@ -376,17 +476,24 @@ void ObjectFile::initialize_symbols() {
   for (i64 i = 0; i < first_global; i++)
     symbols[i] = &locals[i];
 
-  // Initialize global symbols
-  for (i64 i = first_global; i < elf_syms.size(); i++) {
-    const ElfSym &esym = elf_syms[i];
-    std::string_view name = symbol_strtab.data() + esym.st_name;
+  // Initialize global symbols. We compute hashes of all symbol names
+  // first and then intern them.
+  std::vector<std::string_view> names(elf_syms.size() - first_global);
+  std::vector<u64> hashes(names.size());
+
+  for (i64 i = 0; i < names.size(); i++) {
+    std::string_view name = symbol_strtab.data() + elf_syms[first_global + i].st_name;
     i64 pos = name.find('@');
     if (pos != std::string_view::npos)
       name = name.substr(0, pos);
+    names[i] = name;
+    hashes[i] = hash_string(name);
+  }
 
-    symbols[i] = Symbol::intern(name);
+  for (i64 i = first_global; i < elf_syms.size(); i++) {
+    symbols[i] = Symbol::intern(names[i - first_global], hashes[i - first_global]);
 
-    if (esym.is_common())
+    if (elf_syms[i].is_common())
       has_common_symbol = true;
   }
 }
@@ -408,22 +515,40 @@ static i64 binary_search(std::span<u32> span, i64 val) {
   return ret;
 }
 
+// Files larger than this are parsed with nested parallelism, so that
+// a few huge objects don't keep a single core busy for a long time.
+static constexpr i64 PARALLEL_PARSE_THRESHOLD = 4 * 1024 * 1024;
+
+template <typename Fn>
+void ObjectFile::for_each_index(i64 n, Fn fn) {
+  if (mb->size() < PARALLEL_PARSE_THRESHOLD) {
+    for (i64 i = 0; i < n; i++)
+      fn(i);
+    return;
+  }
+  tbb::parallel_for((i64)0, n, fn);
+}
+
 void ObjectFile::initialize_mergeable_sections() {
   mergeable_sections.resize(sections.size());
 
-  for (i64 i = 0; i < sections.size(); i++) {
+  // Split mergeable sections into fragments
+  for_each_index(sections.size(), [&](i64 i) {
     if (InputSection *isec = sections[i]) {
       if (isec->shdr.sh_flags & SHF_MERGE) {
-        mergeable_sections[i] = new MergeableSection(isec);
+        mergeable_sections[i] = Arena::create<MergeableSection>(isec);
         sections[i] = nullptr;
       }
     }
-  }
+  });
 
   // Initialize rel_fragments
-  for (InputSection *isec : sections) {
+  for_each_index(sections.size(), [&](i64 j) {
+    InputSection *isec = sections[j];
     if (!isec || isec->rels.empty())
-      continue;
+      return;
+
+    std::vector<SectionFragmentRef> refs;
 
     for (i64 i = 0; i < isec->rels.size(); i++) {
       const ElfRela &rel = isec->rels[i];
@@ -441,20 +566,22 @@ void ObjectFile::initialize_mergeable_sections() {
         Fatal() << *this << ": bad relocation at " << rel.r_sym;
 
       SectionFragmentRef ref{m->fragments[idx], (i32)(offset - m->frag_offsets[idx])};
-      isec->rel_fragments.push_back(ref);
+      refs.push_back(ref);
       isec->has_fragments[i] = true;
     }
-  }
+
+    isec->rel_fragments = Arena::copy<SectionFragmentRef>(refs);
+  });
 
   // Initialize sym_fragments
-  for (i64 i = 0; i < elf_syms.size(); i++) {
+  for_each_index(elf_syms.size(), [&](i64 i) {
     const ElfSym &esym = elf_syms[i];
     if (esym.is_abs() || esym.is_common())
-      continue;
+      return;
 
     MergeableSection *m = mergeable_sections[esym.st_shndx];
     if (!m)
-      continue;
+      return;
 
     i64 idx = binary_search(m->frag_offsets, esym.st_value);
     if (idx == -1)
@@ -467,12 +594,16 @@ void ObjectFile::initialize_mergeable_sections() {
       sym_fragments[i - first_global].frag = m->fragments[idx];
       sym_fragments[i - first_global].addend = esym.st_value - m->frag_offsets[idx];
     }
-  }
+  });
 
   erase(mergeable_sections, [](MergeableSection *m) { return !m; });
 }
 
 void ObjectFile::parse() {
+  static Counter counter("parsed_objs");
+  counter.inc();
+
+  mb->advise();
   sections.resize(elf_sections.size());
   symtab_sec = find_section(SHT_SYMTAB);
 
@@ -497,6 +628,12 @@ void ObjectFile::parse() {
 //  4. Unclaimed (nonexistent) symbol
 //
 // Ties are broken by file priority.
+//
+// A rank packs a priority class and a file priority into a single u64,
+// so symbols are resolved without locks by atomically lowering
+// Symbol::rank. The lower 32 bits of a symbol's rank identify the file
+// that currently owns the symbol. Once resolution is done, the owner
+// fills in the other members of the symbol in claim_resolved_symbols().
 static u64 get_rank(InputFile *file, const ElfSym &esym, InputSection *isec) {
   if (isec && isec->is_comdat_member)
     return file->priority;
@@ -509,77 +646,59 @@ static u64 get_rank(InputFile *file, const ElfSym &esym, InputSection *isec) {
   return file->priority;
 }
 
-static u64 get_rank(const Symbol &sym) {
-  if (!sym.file)
-    return (u64)4 << 32;
-  if (sym.is_placeholder)
-    return ((u64)3 << 32) + sym.file->priority;
-  return get_rank(sym.file, *sym.esym, sym.input_section);
+static u64 get_lazy_rank(InputFile *file) {
+  return ((u64)3 << 32) + file->priority;
 }
 
-void ObjectFile::maybe_override_symbol(Symbol &sym, i64 symidx) {
-  InputSection *isec = nullptr;
-  const ElfSym &esym = elf_syms[symidx];
-  if (!esym.is_abs() && !esym.is_common())
-    isec = sections[esym.st_shndx];
-
-  std::lock_guard lock(sym.mu);
+static InputFile *get_owner(const Symbol &sym) {
+  return out::files_by_priority[(u32)sym.rank];
+}
 
-  u64 new_rank = get_rank(this, esym, isec);
-  u64 existing_rank = get_rank(sym);
+// Lowers a symbol's rank to a given value if it is smaller than the
+// current one.
+static void lower_rank(Symbol &sym, u64 rank) {
+  u64 cur = sym.rank.load(std::memory_order_relaxed);
+  while (rank < cur && !sym.rank.compare_exchange_weak(cur, rank));
+}
 
-  if (new_rank < existing_rank) {
-    sym.file = this;
-    sym.input_section = isec;
-    if (SectionFragmentRef &ref = sym_fragments[symidx - first_global]; ref.frag) {
-      sym.frag = ref.frag;
-      sym.value = ref.addend;
-    } else {
-      sym.value = esym.st_value;
-    }
-    sym.ver_idx = 0;
-    sym.st_type = esym.st_type;
-    sym.esym = &esym;
-    sym.is_placeholder = false;
-    sym.is_weak = (esym.st_bind == STB_WEAK);
-    sym.is_imported = false;
+InputSection *ObjectFile::get_section(const ElfSym &esym) {
+  if (esym.is_abs() || esym.is_common())
+    return nullptr;
+  return sections[esym.st_shndx];
+}
 
-    if (sym.traced)
-      SyncOut() << "trace: " << *sym.file
-                << (sym.is_weak ? ": weak definition of " : ": definition of ")
-                << sym.name;
-  }
+void ObjectFile::maybe_override_symbol(Symbol &sym, i64 symidx) {
+  const ElfSym &esym = elf_syms[symidx];
+  lower_rank(sym, get_rank(this, esym, get_section(esym)));
 }
 
 void ObjectFile::resolve_symbols() {
+  // If this file hasn't been parsed yet, symbol names in the archive
+  // symbol table are all we have.
+  if (is_lazy) {
+    for (std::string_view name : lazy_symbols) {
+      i64 pos = name.find('@');
+      if (pos != std::string_view::npos)
+        name = name.substr(0, pos);
+      lower_rank(*Symbol::intern(name), get_lazy_rank(this));
+    }
+    return;
+  }
+
   for (i64 i = first_global; i < symbols.size(); i++) {
     const ElfSym &esym = elf_syms[i];
     if (!esym.is_defined())
       continue;
 
     Symbol &sym = *symbols[i];
-
-    if (is_in_archive) {
-      std::lock_guard lock(sym.mu);
-      bool is_new = !sym.file;
-      bool tie_but_higher_priority =
-        sym.is_placeholder && this->priority < sym.file->priority;
-
-      if (is_new || tie_but_higher_priority) {
-        sym.file = this;
-        sym.is_placeholder = true;
-
-        if (sym.traced)
-          SyncOut() << "trace: " << *sym.file
-                    << ": lazy definition of " << sym.name;
-      }
-    } else {
+    if (is_in_archive)
+      lower_rank(sym, get_lazy_rank(this));
+    else
       maybe_override_symbol(sym, i);
-    }
   }
 }
 
-void ObjectFile::mark_live_objects(std::function<void(ObjectFile *)> feeder) {
+void ObjectFile::mark_live_objects(tbb::parallel_do_feeder<ObjectFile *> &feeder) {
   assert(is_alive);
 
   for (i64 i = first_global; i < symbols.size(); i++) {
@@ -595,12 +714,14 @@ void ObjectFile::mark_live_objects(std::function<void(ObjectFile *)> feeder) {
     if (sym.traced)
       SyncOut() << "trace: " <<  *this << ": reference to " << sym.name;
 
-    if (esym.st_bind != STB_WEAK && sym.file && !sym.file->is_alive.exchange(true)) {
-      if (!sym.file->is_dso)
-        feeder((ObjectFile *)sym.file);
+    InputFile *file = get_owner(sym);
+
+    if (esym.st_bind != STB_WEAK && file && !file->is_alive.exchange(true)) {
+      if (!file->is_dso)
+        feeder.add((ObjectFile *)file);
 
       if (sym.traced)
-        SyncOut() << "trace: " << *this << " keeps " << *sym.file
+        SyncOut() << "trace: " << *this << " keeps " << *file
                   << " for " << sym.name;
     }
   }
@@ -609,29 +730,82 @@ void ObjectFile::mark_live_objects(std::function<void(ObjectFile *)> feeder) {
 void ObjectFile::handle_undefined_weak_symbols() {
   for (i64 i = first_global; i < symbols.size(); i++) {
     const ElfSym &esym = elf_syms[i];
+    if (esym.is_undef() && esym.st_bind == STB_WEAK)
+      lower_rank(*symbols[i], get_rank(this, esym, nullptr));
+  }
+}
 
-    if (esym.is_undef() && esym.st_bind == STB_WEAK) {
-      Symbol &sym = *symbols[i];
-      std::lock_guard lock(sym.mu);
+// This function is called after symbol resolution. For each symbol
+// that this file won, it sets symbol members. Only one file can own a
+// symbol, so no locking is needed.
+void ObjectFile::claim_resolved_symbols() {
+  if (is_lazy)
+    return;
+
+  for (i64 i = first_global; i < symbols.size(); i++) {
+    const ElfSym &esym = elf_syms[i];
+    Symbol &sym = *symbols[i];
 
-      bool is_new = !sym.file || sym.is_placeholder;
-      bool tie_but_higher_priority =
-        !is_new && sym.is_undef_weak && this->priority < sym.file->priority;
+    // If the same symbol appears more than once in this file,
+    // the first one wins.
+    if (sym.file == this && !sym.is_placeholder)
+      continue;
 
-      if (is_new || tie_but_higher_priority) {
+    if (esym.is_undef()) {
+      if (esym.st_bind != STB_WEAK || sym.rank != get_rank(this, esym, nullptr))
+        continue;
+
+      sym.file = this;
+      sym.input_section = nullptr;
+      sym.frag = nullptr;
+      sym.value = 0;
+      sym.esym = &esym;
+      sym.is_placeholder = false;
+      sym.is_undef_weak = true;
+      sym.is_imported = false;
+
+      if (sym.traced)
+        SyncOut() << "trace: " << *this << ": unresolved weak symbol "
+                  << sym.name;
+      continue;
+    }
+
+    if (!is_alive) {
+      if (is_in_archive && sym.rank == get_lazy_rank(this)) {
         sym.file = this;
-        sym.input_section = nullptr;
-        sym.value = 0;
-        sym.esym = &esym;
-        sym.is_placeholder = false;
-        sym.is_undef_weak = true;
-        sym.is_imported = false;
+        sym.is_placeholder = true;
 
         if (sym.traced)
-          SyncOut() << "trace: " << *this << ": unresolved weak symbol "
-                    << sym.name;
+          SyncOut() << "trace: " << *sym.file
+                    << ": lazy definition of " << sym.name;
       }
+      continue;
     }
+
+    InputSection *isec = get_section(esym);
+    if (sym.rank != get_rank(this, esym, isec))
+      continue;
+
+    sym.file = this;
+    sym.input_section = isec;
+    if (SectionFragmentRef &ref = sym_fragments[i - first_global]; ref.frag) {
+      sym.frag = ref.frag;
+      sym.value = ref.addend;
+    } else {
+      sym.frag = nullptr;
+      sym.value = esym.st_value;
+    }
+    sym.ver_idx = 0;
+    sym.st_type = esym.st_type;
+    sym.esym = &esym;
+    sym.is_placeholder = false;
+    sym.is_weak = (esym.st_bind == STB_WEAK);
+    sym.is_imported = false;
+
+    if (sym.traced)
+      SyncOut() << "trace: " << *sym.file
+                << (sym.is_weak ? ": weak definition of " : ": definition of ")
+                << sym.name;
   }
 }
 
@@ -661,6 +835,24 @@ void ObjectFile::eliminate_duplicate_comdat_groups() {
   }
 }
 
+// Returns the output addresses of local symbols. Relocations in debug
+// sections mostly refer to a few section symbols, so we compute their
+// addresses once per file when the first debug section is written.
+// Symbols in discarded sections are -1.
+std::span<u64> ObjectFile::get_local_addrs() {
+  std::call_once(local_addrs_once, [&]() {
+    local_addrs.resize(first_global);
+    for (i64 i = 1; i < first_global; i++) {
+      Symbol &sym = *symbols[i];
+      if (sym.input_section && !sym.input_section->is_alive)
+        local_addrs[i] = -1;
+      else
+        local_addrs[i] = sym.get_addr();
+    }
+  });
+  return local_addrs;
+}
+
 void ObjectFile::scan_relocations() {
   // Scan relocations against seciton contents
   for (InputSection *isec : sections)
@@ -726,18 +918,21 @@ void ObjectFile::compute_symtab() {
     for (i64 i = 1; i < first_global; i++) {
       Symbol &sym = *symbols[i];
       if (sym.write_symtab && !sym.is_alive()) {
-        strtab_size -= sym.name.size() + 1;
         num_local_symtab--;
         sym.write_symtab = false;
       }
     }
   }
 
+  for (i64 i = 1; i < first_global; i++)
+    if (symbols[i]->write_symtab)
+      out::strtab->add_string(symbols[i]->name);
+
   // Compute the size of global symbols.
   for (i64 i = first_global; i < elf_syms.size(); i++) {
     Symbol &sym = *symbols[i];
     if (sym.file == this && should_write_global_symtab(sym)) {
-      strtab_size += sym.name.size() + 1;
+      out::strtab->add_string(sym.name);
       num_global_symtab++;
     }
   }
@@ -745,9 +940,7 @@ void ObjectFile::compute_symtab() {
 
 void ObjectFile::write_symtab() {
   u8 *symtab_base = out::buf + out::symtab->shdr.sh_offset;
-  u8 *strtab_base = out::buf + out::strtab->shdr.sh_offset;
   i64 symtab_off;
-  i64 strtab_off = strtab_offset;
 
   auto write_sym = [&](i64 i) {
     Symbol &sym = *symbols[i];
@@ -755,7 +948,7 @@ void ObjectFile::write_symtab() {
     symtab_off += sizeof(ElfSym);
 
     esym = elf_syms[i];
-    esym.st_name = strtab_off;
+    esym.st_name = out::strtab->find_string(sym.name);
 
     if (sym.st_type == STT_TLS)
       esym.st_value = sym.get_addr() - out::tls_begin;
@@ -768,9 +961,6 @@ void ObjectFile::write_symtab() {
       esym.st_shndx = sym.shndx;
     else
       esym.st_shndx = SHN_ABS;
-
-    write_string(strtab_base + strtab_off, sym.name);
-    strtab_off += sym.name.size() + 1;
   };
 
   symtab_off = local_symtab_offset;
@@ -871,6 +1061,7 @@ std::string_view SharedFile::get_soname() {
 }
 
 void SharedFile::parse() {
+  mb->advise();
   symtab_sec = find_section(SHT_DYNSYM);
   if (!symtab_sec)
     return;
@@ -950,32 +1141,33 @@ std::vector<std::string_view> SharedFile::read_verdef() {
 }
 
 void SharedFile::resolve_symbols() {
+  for (i64 i = 0; i < symbols.size(); i++)
+    lower_rank(*symbols[i], get_rank(this, *elf_syms[i], nullptr));
+}
+
+void SharedFile::claim_resolved_symbols() {
   for (i64 i = 0; i < symbols.size(); i++) {
     Symbol &sym = *symbols[i];
     const ElfSym &esym = *elf_syms[i];
 
-    std::lock_guard lock(sym.mu);
-
-    u64 new_rank = get_rank(this, esym, nullptr);
-    u64 existing_rank = get_rank(sym);
+    if (sym.file == this || sym.rank != get_rank(this, esym, nullptr))
+      continue;
 
-    if (new_rank < existing_rank) {
-      sym.file = this;
-      sym.input_section = nullptr;
-      sym.frag = nullptr;
-      sym.value = esym.st_value;
-      sym.ver_idx = versyms[i];
-      sym.st_type = (esym.st_type == STT_GNU_IFUNC) ? STT_FUNC : esym.st_type;
-      sym.esym = &esym;
-      sym.is_placeholder = false;
-      sym.is_weak = (esym.st_bind == STB_WEAK);
-      sym.is_imported = true;
+    sym.file = this;
+    sym.input_section = nullptr;
+    sym.frag = nullptr;
+    sym.value = esym.st_value;
+    sym.ver_idx = versyms[i];
+    sym.st_type = (esym.st_type == STT_GNU_IFUNC) ? STT_FUNC : esym.st_type;
+    sym.esym = &esym;
+    sym.is_placeholder = false;
+    sym.is_weak = (esym.st_bind == STB_WEAK);
+    sym.is_imported = true;
 
-      if (sym.traced)
-        SyncOut() << "trace: " << *sym.file
-                  << (sym.is_weak ? ": weak definition of " : ": definition of ")
-                  << sym.name;
-    }
+    if (sym.traced)
+      SyncOut() << "trace: " << *sym.file
+                << (sym.is_weak ? ": weak definition of " : ": definition of ")
+                << sym.name;
   }
 }
 
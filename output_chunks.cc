@@ -4,7 +4,9 @@
 #include <openssl/sha.h>
 #include <shared_mutex>
 #include <tbb/parallel_for_each.h>
+#include <tbb/parallel_scan.h>
 #include <tbb/parallel_sort.h>
+#include <zlib.h>
 
 void OutputEhdr::copy_buf() {
   ElfEhdr &hdr = *(ElfEhdr *)(out::buf + shdr.sh_offset);
@@ -118,7 +120,8 @@ std::vector<ElfPhdr> create_phdr() {
       break;
 
     i64 flags = to_phdr_flags(first);
-    define(PT_LOAD, flags, PAGE_SIZE, first);
+    bool is_huge = config.z_hugepage_text && (flags & PF_X);
+    define(PT_LOAD, flags, is_huge ? HUGE_PAGE_SIZE : PAGE_SIZE, first);
 
     if (!is_bss(first))
       while (i < end && !is_bss(out::chunks[i]) &&
@@ -177,7 +180,7 @@ void RelDynSection::update_shdr() {
 
   i64 n = 0;
   for (Symbol *sym : out::got->got_syms)
-    if (sym->is_imported || (config.pie && sym->is_relative()))
+    if (sym->is_imported || (config.pie && sym->is_relative() && !out::relrdyn))
       n++;
 
   n += out::got->tlsgd_syms.size() * 2;
@@ -199,14 +202,14 @@ void RelDynSection::copy_buf() {
 
   for (Symbol *sym : out::got->got_syms) {
     if (sym->is_imported)
-      *rel++ = {sym->get_got_addr(), R_X86_64_GLOB_DAT, sym->dynsym_idx, 0};
-    else if (config.pie && sym->is_relative())
+      *rel++ = {sym->get_got_addr(), R_X86_64_GLOB_DAT, sym->get_dynsym_idx(), 0};
+    else if (config.pie && sym->is_relative() && !out::relrdyn)
       *rel++ = {sym->get_got_addr(), R_X86_64_RELATIVE, 0, (i64)sym->get_addr()};
   }
 
   for (Symbol *sym : out::got->tlsgd_syms) {
-    *rel++ = {sym->get_tlsgd_addr(), R_X86_64_DTPMOD64, sym->dynsym_idx, 0};
-    *rel++ = {sym->get_tlsgd_addr() + GOT_SIZE, R_X86_64_DTPOFF64, sym->dynsym_idx, 0};
+    *rel++ = {sym->get_tlsgd_addr(), R_X86_64_DTPMOD64, sym->get_dynsym_idx(), 0};
+    *rel++ = {sym->get_tlsgd_addr() + GOT_SIZE, R_X86_64_DTPOFF64, sym->get_dynsym_idx(), 0};
   }
 
   if (out::got->tlsld_idx != -1)
@@ -214,18 +217,163 @@ void RelDynSection::copy_buf() {
 
   for (Symbol *sym : out::got->gottpoff_syms)
     if (sym->is_imported)
-      *rel++ = {sym->get_gottpoff_addr(), R_X86_64_TPOFF32, sym->dynsym_idx, 0};
+      *rel++ = {sym->get_gottpoff_addr(), R_X86_64_TPOFF32, sym->get_dynsym_idx(), 0};
 
   for (Symbol *sym : out::copyrel->symbols)
-    *rel++ = {sym->get_addr(), R_X86_64_COPY, sym->dynsym_idx, 0};
+    *rel++ = {sym->get_addr(), R_X86_64_COPY, sym->get_dynsym_idx(), 0};
 }
 
-void StrtabSection::update_shdr() {
-  shdr.sh_size = 1;
-  for (ObjectFile *file : out::objs) {
-    file->strtab_offset = shdr.sh_size;
-    shdr.sh_size += file->strtab_size;
+// Encodes sorted, word-aligned offsets in the RELR format.
+static std::vector<u64> encode_relr(std::span<u64> pos) {
+  std::vector<u64> vec;
+
+  for (i64 i = 0; i < pos.size();) {
+    vec.push_back(pos[i]);
+    u64 base = pos[i++] + 8;
+
+    for (;;) {
+      u64 bits = 0;
+      for (; i < pos.size() && pos[i] - base < 63 * 8; i++)
+        bits |= 1LL << ((pos[i] - base) / 8);
+      if (!bits)
+        break;
+      vec.push_back((bits << 1) | 1);
+      base += 63 * 8;
+    }
   }
+  return vec;
+}
+
+void RelrDynSection::construct() {
+  Timer t("relr_dyn");
+
+  std::span<OutputSection *> osecs = OutputSection::instances;
+  contents.resize(osecs.size() + 1);
+
+  tbb::parallel_for((i64)0, (i64)osecs.size(), [&](i64 i) {
+    std::vector<u64> pos;
+    for (InputSection *isec : osecs[i]->members)
+      for (i64 j = 0; j < isec->rel_types.size(); j++)
+        if (isec->rel_types[j] == R_ABS_RELR)
+          pos.push_back(isec->offset + isec->rels[j].r_offset);
+
+    std::sort(pos.begin(), pos.end());
+    pos.erase(std::unique(pos.begin(), pos.end()), pos.end());
+    contents[i] = {osecs[i], encode_relr(pos)};
+  });
+
+  std::vector<u64> pos;
+  for (Symbol *sym : out::got->got_syms)
+    if (!sym->is_imported && sym->is_relative())
+      pos.push_back(sym->get_got_idx() * GOT_SIZE);
+  contents.back() = {out::got, encode_relr(pos)};
+
+  for (std::pair<OutputChunk *, std::vector<u64>> &pair : contents)
+    shdr.sh_size += pair.second.size() * 8;
+}
+
+void RelrDynSection::copy_buf() {
+  u64 *buf = (u64 *)(out::buf + shdr.sh_offset);
+
+  for (std::pair<OutputChunk *, std::vector<u64>> &pair : contents)
+    for (u64 val : pair.second)
+      *buf++ = (val & 1) ? val : val + pair.first->shdr.sh_addr;
+}
+
+// Returns the size of the string table. Strings can no longer be
+// added once this function is called.
+i64 StringTable::finalize() {
+  if (size != -1)
+    return size;
+
+  strings.clear();
+  strings.reserve(map.size());
+  for (std::pair<std::string_view, i64> pair : map)
+    strings.push_back({pair.first, 0});
+
+  // Sort strings in reverse lexicographical order, comparing from the
+  // last character. A string then immediately follows a longer string
+  // that ends with it, if any.
+  tbb::parallel_sort(strings.begin(), strings.end(),
+                     [](const std::pair<std::string_view, i64> &a,
+                        const std::pair<std::string_view, i64> &b) {
+    return std::lexicographical_compare(b.first.rbegin(), b.first.rend(),
+                                        a.first.rbegin(), a.first.rend());
+  });
+
+  i64 num_strings = strings.size();
+  is_suffix.clear();
+  is_suffix.resize(num_strings);
+
+  tbb::parallel_for((i64)1, num_strings, [&](i64 i) {
+    is_suffix[i] = strings[i - 1].first.ends_with(strings[i].first);
+  });
+
+  // Assign offsets to strings that are not suffixes of other strings
+  // with a parallel prefix sum. At the same time, each suffix records
+  // the index of its longest superstring, which is the closest
+  // preceding non-suffix.
+  struct Sum {
+    i64 size;
+    i64 root;
+  };
+
+  std::vector<i64> root_idx(num_strings);
+
+  Sum total = tbb::parallel_scan(
+    tbb::blocked_range<i64>(0, num_strings), Sum{0, -1},
+    [&](const tbb::blocked_range<i64> &r, Sum sum, bool is_final) {
+      for (i64 i = r.begin(); i < r.end(); i++) {
+        if (is_suffix[i]) {
+          if (is_final)
+            root_idx[i] = sum.root;
+          continue;
+        }
+        if (is_final)
+          strings[i].second = sum.size + 1;
+        sum.size += strings[i].first.size() + 1;
+        sum.root = i;
+      }
+      return sum;
+    },
+    [](Sum a, Sum b) {
+      return Sum{a.size + b.size, (b.root == -1) ? a.root : b.root};
+    });
+
+  // The other strings point to their longest superstrings.
+  tbb::parallel_for((i64)0, num_strings, [&](i64 i) {
+    std::pair<std::string_view, i64> &ent = strings[i];
+    if (is_suffix[i]) {
+      std::pair<std::string_view, i64> &root = strings[root_idx[i]];
+      ent.second = root.second + root.first.size() - ent.first.size();
+    }
+
+    decltype(map)::accessor acc;
+    map.find(acc, ent.first);
+    acc->second = ent.second;
+  });
+
+  static Counter counter("strtab_merged_suffixes");
+  counter.inc(std::count(is_suffix.begin(), is_suffix.end(), 1));
+
+  size = total.size + 1;
+  return size;
+}
+
+void StringTable::write(u8 *buf) {
+  buf[0] = '\0';
+  tbb::parallel_for((i64)0, (i64)strings.size(), [&](i64 i) {
+    if (!is_suffix[i])
+      write_string(buf + strings[i].second, strings[i].first);
+  });
+}
+
+void StrtabSection::update_shdr() {
+  shdr.sh_size = strtab.finalize();
+}
+
+void StrtabSection::copy_buf() {
+  strtab.write(out::buf + shdr.sh_offset);
 }
 
 void ShstrtabSection::update_shdr() {
@@ -251,24 +399,12 @@ void ShstrtabSection::copy_buf() {
   }
 }
 
-i64 DynstrSection::add_string(std::string_view str) {
-  auto [it, inserted] = strings.insert({str, shdr.sh_size});
-  if (inserted)
-    shdr.sh_size += str.size() + 1;
-  return it->second;
-}
-
-i64 DynstrSection::find_string(std::string_view str) {
-  auto it = strings.find(str);
-  assert(it != strings.end());
-  return it->second;
+void DynstrSection::finalize() {
+  shdr.sh_size = strtab.finalize();
 }
 
 void DynstrSection::copy_buf() {
-  u8 *base = out::buf + shdr.sh_offset;
-  base[0] = '\0';
-  for (std::pair<std::string_view, i64> pair : strings)
-    write_string(base + pair.second, pair.first);
+  strtab.write(out::buf + shdr.sh_offset);
 }
 
 void SymtabSection::update_shdr() {
@@ -313,6 +449,11 @@ static std::vector<u64> create_dynamic_section() {
   define(DT_RELA, out::reldyn->shdr.sh_addr);
   define(DT_RELASZ, out::reldyn->shdr.sh_size);
   define(DT_RELAENT, sizeof(ElfRela));
+  if (out::relrdyn && out::relrdyn->shdr.sh_size) {
+    define(DT_RELR, out::relrdyn->shdr.sh_addr);
+    define(DT_RELRSZ, out::relrdyn->shdr.sh_size);
+    define(DT_RELRENT, 8);
+  }
   define(DT_JMPREL, out::relplt->shdr.sh_addr);
   define(DT_PLTRELSZ, out::relplt->shdr.sh_size);
   define(DT_PLTGOT, out::gotplt->shdr.sh_addr);
@@ -422,42 +563,44 @@ OutputSection::get_instance(std::string_view name, u64 type, u64 flags) {
 }
 
 void OutputSection::copy_buf() {
-  if (shdr.sh_type == SHT_NOBITS)
-    return;
+  if (shdr.sh_type != SHT_NOBITS)
+    write_to(out::buf + shdr.sh_offset);
+}
 
+void OutputSection::write_to(u8 *buf) {
   tbb::parallel_for((i64)0, (i64)members.size(), [&](u64 i) {
     InputSection &isec = *members[i];
     if (isec.shdr.sh_type == SHT_NOBITS)
       return;
 
     // Copy section contents to an output file
-    isec.copy_buf();
+    isec.write_to(buf + isec.offset);
 
     // Zero-clear trailing padding
     u64 this_end = isec.offset + isec.shdr.sh_size;
     u64 next_start = (i == members.size() - 1) ?
       shdr.sh_size : members[i + 1]->offset;
-    memset(out::buf + shdr.sh_offset + this_end, 0, next_start - this_end);
+    memset(buf + this_end, 0, next_start - this_end);
   });
 }
 
 void GotSection::add_got_symbol(Symbol *sym) {
-  assert(sym->got_idx == -1);
-  sym->got_idx = shdr.sh_size / GOT_SIZE;
+  assert(sym->get_got_idx() == -1);
+  sym->aux().got_idx = shdr.sh_size / GOT_SIZE;
   shdr.sh_size += GOT_SIZE;
   got_syms.push_back(sym);
 }
 
 void GotSection::add_gottpoff_symbol(Symbol *sym) {
-  assert(sym->gottpoff_idx == -1);
-  sym->gottpoff_idx = shdr.sh_size / GOT_SIZE;
+  assert(sym->get_gottpoff_idx() == -1);
+  sym->aux().gottpoff_idx = shdr.sh_size / GOT_SIZE;
   shdr.sh_size += GOT_SIZE;
   gottpoff_syms.push_back(sym);
 }
 
 void GotSection::add_tlsgd_symbol(Symbol *sym) {
-  assert(sym->tlsgd_idx == -1);
-  sym->tlsgd_idx = shdr.sh_size / GOT_SIZE;
+  assert(sym->get_tlsgd_idx() == -1);
+  sym->aux().tlsgd_idx = shdr.sh_size / GOT_SIZE;
   shdr.sh_size += GOT_SIZE * 2;
   tlsgd_syms.push_back(sym);
 }
@@ -475,11 +618,11 @@ void GotSection::copy_buf() {
 
   for (Symbol *sym : got_syms)
     if (!sym->is_imported)
-      buf[sym->got_idx] = sym->get_addr();
+      buf[sym->get_got_idx()] = sym->get_addr();
 
   for (Symbol *sym : gottpoff_syms)
     if (!sym->is_imported)
-      buf[sym->gottpoff_idx] = sym->get_addr() - out::tls_end;
+      buf[sym->get_gottpoff_idx()] = sym->get_addr() - out::tls_end;
 }
 
 void GotPltSection::copy_buf() {
@@ -490,18 +633,18 @@ void GotPltSection::copy_buf() {
   buf[2] = 0;
 
   for (Symbol *sym : out::plt->symbols)
-    if (sym->gotplt_idx != -1)
-      buf[sym->gotplt_idx] = sym->get_plt_addr() + 6;
+    if (sym->get_gotplt_idx() != -1)
+      buf[sym->get_gotplt_idx()] = sym->get_plt_addr() + 6;
 }
 
 void PltSection::add_symbol(Symbol *sym) {
-  assert(sym->plt_idx == -1);
-  sym->plt_idx = shdr.sh_size / PLT_SIZE;
+  assert(sym->get_plt_idx() == -1);
+  sym->aux().plt_idx = shdr.sh_size / PLT_SIZE;
   shdr.sh_size += PLT_SIZE;
   symbols.push_back(sym);
 
-  if (sym->got_idx == -1) {
-    sym->gotplt_idx = out::gotplt->shdr.sh_size / GOT_SIZE;
+  if (sym->get_got_idx() == -1) {
+    sym->aux().gotplt_idx = out::gotplt->shdr.sh_size / GOT_SIZE;
     out::gotplt->shdr.sh_size += GOT_SIZE;
 
     sym->has_relplt = true;
@@ -527,9 +670,9 @@ void PltSection::copy_buf() {
   i64 relplt_idx = 0;
 
   for (Symbol *sym : symbols) {
-    u8 *ent = buf + sym->plt_idx * PLT_SIZE;
+    u8 *ent = buf + sym->get_plt_idx() * PLT_SIZE;
 
-    if (sym->gotplt_idx != -1) {
+    if (sym->get_gotplt_idx() != -1) {
       const u8 data[] = {
         0xff, 0x25, 0, 0, 0, 0, // jmp   *foo@GOTPLT
         0x68, 0,    0, 0, 0,    // push  $index_in_relplt
@@ -568,7 +711,7 @@ void RelPltSection::copy_buf() {
 
     ElfRela &rel = buf[relplt_idx++];
     memset(&rel, 0, sizeof(rel));
-    rel.r_sym = sym->dynsym_idx;
+    rel.r_sym = sym->get_dynsym_idx();
     rel.r_offset = sym->get_gotplt_addr();
 
     if (sym->st_type == STT_GNU_IFUNC) {
@@ -581,9 +724,9 @@ void RelPltSection::copy_buf() {
 }
 
 void DynsymSection::add_symbol(Symbol *sym) {
-  if (sym->dynsym_idx != -1)
+  if (sym->get_dynsym_idx() != -1)
     return;
-  sym->dynsym_idx = -2;
+  sym->aux().dynsym_idx = -2;
   symbols.push_back(sym);
 }
 
@@ -605,20 +748,43 @@ void DynsymSection::sort_symbols() {
       [](Symbol *sym) { return sym->is_imported || sym->esym->is_undef(); });
 
     i64 num_defined = symbols.end() - first_defined;
-    out::gnu_hash->num_buckets = num_defined / out::gnu_hash->LOAD_FACTOR + 1;
-    out::gnu_hash->symoffset = first_defined - symbols.begin();
+    i64 symoffset = first_defined - symbols.begin();
+    u32 num_buckets = num_defined / out::gnu_hash->LOAD_FACTOR + 1;
+    out::gnu_hash->num_buckets = num_buckets;
+    out::gnu_hash->symoffset = symoffset;
+
+    // Hash each name only once, and sort symbols by bucket. Ties are
+    // broken by the original position, so the sort is stable.
+    struct Entry {
+      Symbol *sym;
+      u32 hash;
+      u32 bucket;
+      u32 idx;
+    };
+
+    std::vector<Entry> entries(num_defined);
+    tbb::parallel_for((i64)0, num_defined, [&](i64 i) {
+      Symbol *sym = symbols[symoffset + i];
+      u32 hash = gnu_hash(sym->name);
+      entries[i] = {sym, hash, (u32)(hash % num_buckets), (u32)i};
+    });
 
-    std::stable_sort(first_defined, symbols.end(), [&](Symbol *a, Symbol *b) {
-      i64 x = gnu_hash(a->name) % out::gnu_hash->num_buckets;
-      i64 y = gnu_hash(b->name) % out::gnu_hash->num_buckets;
-      return x < y;
+    tbb::parallel_sort(entries.begin(), entries.end(),
+                       [](const Entry &a, const Entry &b) {
+      return std::tuple(a.bucket, a.idx) < std::tuple(b.bucket, b.idx);
     });
-  }
 
-  for (i64 i = 1; i < symbols.size(); i++) {
-    name_indices.push_back(out::dynstr->add_string(symbols[i]->name));
-    symbols[i]->dynsym_idx = i;
+    hashes.resize(symbols.size());
+    tbb::parallel_for((i64)0, num_defined, [&](i64 i) {
+      symbols[symoffset + i] = entries[i].sym;
+      hashes[symoffset + i] = entries[i].hash;
+    });
   }
+
+  tbb::parallel_for((i64)1, (i64)symbols.size(), [&](i64 i) {
+    out::dynstr->add_string(symbols[i]->name);
+    symbols[i]->aux().dynsym_idx = i;
+  });
 }
 
 void DynsymSection::update_shdr() {
@@ -633,9 +799,9 @@ void DynsymSection::copy_buf() {
   for (i64 i = 1; i < symbols.size(); i++) {
     Symbol &sym = *symbols[i];
 
-    ElfSym &esym = *(ElfSym *)(base + sym.dynsym_idx * sizeof(ElfSym));
+    ElfSym &esym = *(ElfSym *)(base + sym.get_dynsym_idx() * sizeof(ElfSym));
     memset(&esym, 0, sizeof(esym));
-    esym.st_name = name_indices[i];
+    esym.st_name = out::dynstr->find_string(sym.name);
     esym.st_type = sym.st_type;
     esym.st_bind = sym.esym->st_bind;
     esym.st_size = sym.esym->st_size;
@@ -669,19 +835,30 @@ void HashSection::copy_buf() {
   u8 *base = out::buf + shdr.sh_offset;
   memset(base, 0, shdr.sh_size);
 
-  i64 num_slots = out::dynsym->symbols.size();
+  std::span<Symbol *> symbols = out::dynsym->symbols;
+  i64 num_slots = symbols.size();
   u32 *hdr = (u32 *)base;
   u32 *buckets = (u32 *)(base + 8);
   u32 *chains = buckets + num_slots;
 
   hdr[0] = hdr[1] = num_slots;
 
-  for (i64 i = 1; i < out::dynsym->symbols.size(); i++) {
-    Symbol *sym = out::dynsym->symbols[i];
-    i64 idx = elf_hash(sym->name) % num_slots;
-    chains[sym->dynsym_idx] = buckets[idx];
-    buckets[idx] = sym->dynsym_idx;
-  }
+  // Group symbols by bucket. Each bucket points to the symbol with the
+  // largest index, which is chained to the next largest, and so on.
+  std::vector<std::pair<u32, u32>> entries(num_slots - 1);
+  tbb::parallel_for((i64)1, num_slots, [&](i64 i) {
+    entries[i - 1] = {elf_hash(symbols[i]->name) % num_slots, i};
+  });
+
+  tbb::parallel_sort(entries.begin(), entries.end());
+
+  tbb::parallel_for((i64)0, (i64)entries.size(), [&](i64 i) {
+    auto [bucket, idx] = entries[i];
+    if (i > 0 && entries[i - 1].first == bucket)
+      chains[idx] = entries[i - 1].second;
+    if (i == entries.size() - 1 || entries[i + 1].first != bucket)
+      buckets[bucket] = idx;
+  });
 }
 
 void GnuHashSection::update_shdr() {
@@ -710,40 +887,34 @@ void GnuHashSection::copy_buf() {
   *(u32 *)(base + 8) = num_bloom;
   *(u32 *)(base + 12) = BLOOM_SHIFT;
 
-  std::span<Symbol *> symbols = std::span(out::dynsym->symbols).subspan(symoffset);
-  std::vector<u32> hashes(symbols.size());
-  for (i64 i = 0; i < symbols.size(); i++)
-    hashes[i] = gnu_hash(symbols[i]->name);
-
-  // Write a bloom filter
+  std::span<u32> hashes = std::span(out::dynsym->hashes).subspan(symoffset);
   u64 *bloom = (u64 *)(base + HEADER_SIZE);
-  for (i64 hash : hashes) {
-    i64 idx = (hash / 64) % num_bloom;
-    bloom[idx] |= (u64)1 << (hash % ELFCLASS_BITS);
-    bloom[idx] |= (u64)1 << ((hash >> BLOOM_SHIFT) % ELFCLASS_BITS);
-  }
-
-  // Write hash bucket indices
   u32 *buckets = (u32 *)(bloom + num_bloom);
-  for (i64 i = 1; i < hashes.size(); i++) {
-    i64 idx = hashes[i] % num_buckets;
-    if (!buckets[idx])
-      buckets[idx] = i + symoffset;
-  }
-
-  // Write a hash table
   u32 *table = buckets + num_buckets;
-  for (i64 i = 0; i < symbols.size(); i++) {
-    bool is_last = false;
-    if (i == symbols.size() - 1 ||
-        (hashes[i] % num_buckets) != (hashes[i + 1] % num_buckets))
-      is_last = true;
-
-    if (is_last)
-      table[i] = hashes[i] | 1;
-    else
-      table[i] = hashes[i] & ~(u32)1;
-  }
+
+  // Symbols are sorted by bucket, so each bucket points to the first
+  // symbol of a run, and the last symbol of a run is marked by the
+  // least significant bit of its hash value.
+  tbb::parallel_for((i64)0, (i64)hashes.size(), [&](i64 i) {
+    u32 hash = hashes[i];
+
+    // Write a bloom filter
+    i64 idx = (hash / 64) % num_bloom;
+    std::atomic_ref<u64>(bloom[idx]).fetch_or(
+      ((u64)1 << (hash % ELFCLASS_BITS)) |
+      ((u64)1 << ((hash >> BLOOM_SHIFT) % ELFCLASS_BITS)),
+      std::memory_order_relaxed);
+
+    // Write a hash bucket index
+    u32 bucket = hash % num_buckets;
+    if (i == 0 || hashes[i - 1] % num_buckets != bucket)
+      buckets[bucket] = i + symoffset;
+
+    // Write a hash table
+    bool is_last = (i == hashes.size() - 1 ||
+                    hashes[i + 1] % num_buckets != bucket);
+    table[i] = is_last ? (hash | 1) : (hash & ~(u32)1);
+  });
 }
 
 MergedSection *
@@ -772,38 +943,43 @@ MergedSection::get_instance(std::string_view name, u64 type, u64 flags) {
   if (MergedSection *osec = find())
     return osec;
 
-  auto *osec = new MergedSection(name, flags, type);
-  MergedSection::instances.push_back(osec);
-  return osec;
+  return new MergedSection(name, flags, type);
 }
 
-void MergedSection::copy_buf() {
-  u8 *base = out::buf + shdr.sh_offset;
-
-  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
-    for (MergeableSection *isec : file->mergeable_sections) {
-      if (&isec->parent != this)
-        continue;
+// Returns a unique fragment for a given string. `hash` must have been
+// computed by hash_fragment().
+SectionFragment *
+MergedSection::insert(std::string_view data, u64 hash, u32 alignment) {
+  auto is_equal = [&](const SectionFragment &frag) {
+    return frag.data == data && frag.alignment == alignment;
+  };
+  return map.insert(hash, is_equal, data, alignment);
+}
 
-      // Clear padding between input sections
-      if (isec->padding)
-        memset(base + isec->offset - isec->padding, 0, isec->padding);
+void MergedSection::copy_buf() {
+  write_to(out::buf + shdr.sh_offset);
+}
 
-      i64 offset = 0;
-      for (SectionFragment *frag : isec->fragments) {
-        if (frag->isec != isec || !frag->is_alive || frag->offset < offset)
-          continue;
+void MergedSection::write_to(u8 *base) {
+  tbb::parallel_for_each(members, [&](MergeableSection *isec) {
+    // Clear padding between input sections
+    if (isec->padding)
+      memset(base + isec->offset - isec->padding, 0, isec->padding);
 
-        // Clear padding between section fragments
-        if (offset < frag->offset) {
-          memset(base + isec->offset + offset, 0, frag->offset - offset);
-          offset = frag->offset;
-        }
+    i64 offset = 0;
+    for (SectionFragment *frag : isec->fragments) {
+      if (frag->isec != isec || !frag->is_alive || frag->offset < offset)
+        continue;
 
-        memcpy(base + isec->offset + frag->offset,
-               frag->data.data(), frag->data.size());
-        offset += frag->data.size();
+      // Clear padding between section fragments
+      if (offset < frag->offset) {
+        memset(base + isec->offset + offset, 0, frag->offset - offset);
+        offset = frag->offset;
       }
+
+      memcpy(base + isec->offset + frag->offset,
+             frag->data.data(), frag->data.size());
+      offset += frag->data.size();
     }
   });
 
@@ -811,6 +987,17 @@ void MergedSection::copy_buf() {
   merged_strings.inc(map.size());
 }
 
+bool CieRecord::should_merge(const CieRecord &other) const {
+  return contents == other.contents && std::ranges::equal(rels, other.rels);
+}
+
+static u64 hash_cie(const CieRecord &cie) {
+  u64 hash = hash_string(cie.contents);
+  for (const EhReloc &rel : cie.rels)
+    hash ^= hash_string({(char *)&rel.sym, sizeof(Symbol *)}) + rel.offset;
+  return hash;
+}
+
 void EhFrameSection::construct() {
   // Remove dead FDEs and assign them offsets within their corresponding
   // CIE group.
@@ -838,31 +1025,99 @@ void EhFrameSection::construct() {
     for (CieRecord &cie : file->cies)
       cies.push_back(&cie);
 
-  // Record the total number of FDes for .eh_frame_hdr.
-  for (CieRecord *cie : cies) {
-    cie->fde_idx = num_fdes;
-    num_fdes += cie->num_fdes;
-  }
+  // Find the first occurrence of each distinct CIE. Only the first
+  // one is written to the output, and all the other identical CIEs
+  // share it. Zero terminators are not real CIEs, so we don't merge them.
+  struct CieGroup {
+    CieGroup(CieRecord *cie, u32 idx) : cie(cie), leader_idx(idx) {}
+    CieRecord *cie;
+    std::atomic_uint32_t leader_idx;
+  };
 
-  // Assign offsets within the output section to CIEs.
-  auto should_merge = [](CieRecord &a, CieRecord &b) {
-    return a.contents == b.contents && a.rels == b.rels;
+  struct CieGroupHash {
+    static u64 hash(const CieGroup &group) { return hash_cie(*group.cie); }
   };
 
-  i64 offset = 0;
-  for (i64 i = 0; i < cies.size(); i++) {
+  ConcurrentTable<CieGroup, CieGroupHash> table;
+  std::vector<CieGroup *> groups(cies.size());
+
+  tbb::parallel_for((i64)0, (i64)cies.size(), [&](i64 i) {
     CieRecord &cie = *cies[i];
-    cie.offset = offset;
+    if (cie.contents.size() <= 4)
+      return;
 
-    if (i == 0 || !should_merge(cie, *cies[i - 1])) {
-      cie.leader_offset = offset;
-      offset += cie.contents.size() + cie.fde_size;
-    } else {
-      cie.leader_offset = cies[i - 1]->leader_offset;
+    CieGroup *group = table.insert(hash_cie(cie), [&](const CieGroup &group) {
+      return group.cie->should_merge(cie);
+    }, &cie, i);
+
+    u32 cur = group->leader_idx;
+    while (i < cur && !group->leader_idx.compare_exchange_weak(cur, i));
+    groups[i] = group;
+  });
+
+  auto get_leader = [&](i64 i) -> i64 {
+    return groups[i] ? groups[i]->leader_idx.load() : i;
+  };
+
+  // Assign offsets within the output section to CIEs and FDEs, and
+  // assign indices in .eh_frame_hdr to FDEs. This is a parallel prefix
+  // sum over the CIE list.
+  std::vector<std::span<CieRecord *>> slices;
+  for (std::span<CieRecord *> span = cies; !span.empty();) {
+    i64 n = std::min<i64>(span.size(), 10000);
+    slices.push_back(span.subspan(0, n));
+    span = span.subspan(n);
+  }
+
+  std::vector<i64> sizes(slices.size());
+  std::vector<i64> counts(slices.size());
+
+  tbb::parallel_for((i64)0, (i64)slices.size(), [&](i64 i) {
+    i64 offset = 0;
+    i64 count = 0;
+    i64 begin = slices[i].data() - cies.data();
+
+    for (i64 j = begin; j < begin + slices[i].size(); j++) {
+      CieRecord &cie = *cies[j];
+      cie.offset = offset;
+      cie.fde_idx = count;
+      if (get_leader(j) == j)
+        offset += cie.contents.size();
       offset += cie.fde_size;
+      count += cie.num_fdes;
     }
+
+    sizes[i] = offset;
+    counts[i] = count;
+  });
+
+  std::vector<i64> offsets(slices.size() + 1);
+  std::vector<i64> indices(slices.size() + 1);
+  for (i64 i = 0; i < slices.size(); i++) {
+    offsets[i + 1] = offsets[i] + sizes[i];
+    indices[i + 1] = indices[i] + counts[i];
   }
-  shdr.sh_size = offset;
+
+  tbb::parallel_for((i64)0, (i64)slices.size(), [&](i64 i) {
+    for (CieRecord *cie : slices[i]) {
+      cie->offset += offsets[i];
+      cie->fde_idx += indices[i];
+    }
+  });
+
+  static Counter num_cies("eh_frame_cies");
+  static Counter unique_cies("eh_frame_unique_cies");
+  num_cies.inc(cies.size());
+
+  tbb::parallel_for((i64)0, (i64)cies.size(), [&](i64 i) {
+    i64 leader = get_leader(i);
+    cies[i]->leader_offset = cies[leader]->offset;
+    if (leader == i)
+      unique_cies.inc();
+  });
+
+  shdr.sh_size = offsets.back();
+  num_fdes = indices.back();
 
   if (out::eh_frame_hdr)
     out::eh_frame_hdr->shdr.sh_size =
@@ -959,7 +1214,7 @@ void EhFrameSection::copy_buf() {
 u64 EhFrameSection::get_addr(const Symbol &sym) {
   InputSection &isec = *sym.input_section;
   ObjectFile &file = *isec.file;
-  const char *section_begin = isec.get_contents().data();
+  const char *ptr = isec.get_contents().data() + sym.value;
 
   auto contains = [](std::string_view str, const char *ptr) {
     const char *begin = str.data();
@@ -967,28 +1222,33 @@ u64 EhFrameSection::get_addr(const Symbol &sym) {
     return (begin == ptr) || (begin < ptr && ptr < end);
   };
 
-  for (CieRecord &cie : file.cies) {
-    u64 offset = 0;
+  // Find the last record of the symbol's section that begins at or
+  // before the symbol.
+  u32 shndx = isec.get_section_idx();
+  auto it = std::upper_bound(file.ehframe_index.begin(), file.ehframe_index.end(),
+                             std::tuple(shndx, ptr),
+                             [](std::tuple<u32, const char *> key,
+                                const EhFrameRef &ref) {
+    return key < std::tuple(ref.shndx, ref.begin);
+  });
 
-    if (cie.offset == cie.leader_offset) {
-      if (contains(cie.contents, section_begin + offset)) {
-        u64 cie_addr = shdr.sh_addr + cie.offset;
-        u64 addend = sym.value - offset;
-        return cie_addr + addend;
-      }
-      offset += cie.contents.size();
-    }
+  if (it != file.ehframe_index.begin() && (it - 1)->shndx == shndx) {
+    EhFrameRef &ref = *(it - 1);
+    CieRecord &cie = file.cies[ref.cie_idx];
 
-    for (FdeRecord &fde : cie.fdes) {
-      if (contains(fde.contents, section_begin + offset)) {
-        if (!fde.is_alive)
+    if (ref.fde_idx == -1) {
+      if (contains(cie.contents, ptr))
+        return shdr.sh_addr + cie.leader_offset + (ptr - cie.contents.data());
+    } else {
+      FdeRecord &fde = cie.fdes[ref.fde_idx];
+      if (contains(fde.contents, ptr)) {
+        if (fde.offset == -1)
           return 0;
 
-        u64 fde_addr = shdr.sh_addr + cie.offset + offset;
-        u64 addend = sym.value - offset;
-        return fde_addr + addend;
+        i64 cie_size = (cie.offset == cie.leader_offset) ? cie.contents.size() : 0;
+        u64 fde_addr = shdr.sh_addr + cie.offset + cie_size + fde.offset;
+        return fde_addr + (ptr - fde.contents.data());
       }
-      offset += fde.contents.size();
     }
   }
 
@@ -1030,6 +1290,7 @@ static i64 get_buildid_size() {
   switch (config.build_id) {
   case BuildIdKind::UUID:
   case BuildIdKind::MD5:
+  case BuildIdKind::FAST:
     return 16;
   case BuildIdKind::SHA1:
     return 20;
@@ -1052,32 +1313,211 @@ void BuildIdSection::copy_buf() {
   memcpy(base + 3, "GNU", 4);   // Name string
 }
 
-static void compute_sha256(u8 *buf, i64 size, u8 *digest) {
-  i64 shard_size = 1024 * 1024;
-  i64 num_shards = size / shard_size + 1;
-  std::vector<u8> shards(num_shards * SHA256_SIZE);
+// We compute a build ID as a hash tree of 1 MiB shards of the output
+// file. Instead of reading the entire output file again after all
+// chunks are written, we hash each shard as soon as all chunks that may
+// write to it have finished, while the shard is still hot in cache.
+static constexpr i64 SHARD_SIZE = 1024 * 1024;
+
+// Returns the ranges of shards that a given chunk's copy_buf() may
+// write. In addition to its own contents and the padding that follows
+// it, some chunks write to other chunks.
+std::vector<std::pair<i64, i64>> BuildIdSection::get_shards_for(i64 idx) {
+  std::vector<std::pair<i64, i64>> ranges = {extents[idx]};
+  OutputChunk *chunk = out::chunks[idx];
+
+  auto add = [&](OutputChunk *other) {
+    if (other)
+      ranges.push_back({other->shdr.sh_offset,
+                        other->shdr.sh_offset + other->shdr.sh_size});
+  };
 
-  tbb::parallel_for((i64)0, num_shards, [&](i64 i) {
-    u8 *begin = buf + shard_size * i;
-    i64 sz = (i < num_shards - 1) ? shard_size : (size % shard_size);
-    SHA256(begin, sz, shards.data() + i * SHA256_SIZE);
-  });
+  if (chunk->kind == OutputChunk::REGULAR)
+    add(out::reldyn);
+  if (chunk == out::symtab)
+    add(out::strtab);
+  if (chunk == out::eh_frame)
+    add(out::eh_frame_hdr);
+
+  std::vector<std::pair<i64, i64>> shards;
+  for (std::pair<i64, i64> r : ranges)
+    if (r.first < r.second)
+      shards.push_back({r.first / SHARD_SIZE, (r.second - 1) / SHARD_SIZE + 1});
+  return shards;
+}
 
-  SHA256(shards.data(), shards.size(), digest);
+void BuildIdSection::hash_shard(i64 shard) {
+  u8 *begin = out::buf + shard * SHARD_SIZE;
+  i64 size = std::min(SHARD_SIZE, filesize - shard * SHARD_SIZE);
+  u8 *digest = digests.data() + shard * digest_size;
+
+  if (config.build_id == BuildIdKind::FAST) {
+    Hash128 h;
+    h.update(begin, size);
+    h.finish(digest);
+  } else {
+    // Modern x86 processors have purpose-built instructions to accelerate
+    // SHA256 computation, and SHA256 outperforms MD5 on such computers.
+    // So, we always compute SHA256 and truncate it if smaller digest was
+    // requested.
+    SHA256(begin, size, digest);
+  }
 }
 
-void BuildIdSection::write_buildid(i64 filesize) {
+// This function is called before copy_buf() is called for any chunk.
+void BuildIdSection::start_hashing(i64 filesize) {
+  if (config.build_id == BuildIdKind::UUID)
+    return;
+
+  this->filesize = filesize;
+  digest_size = (config.build_id == BuildIdKind::FAST)
+    ? Hash128::HASH_SIZE : SHA256_SIZE;
+
+  i64 num_shards = (filesize + SHARD_SIZE - 1) / SHARD_SIZE;
+  refcounts.reset(new std::atomic_int32_t[num_shards]);
+  for (i64 i = 0; i < num_shards; i++)
+    refcounts[i] = 0;
+  digests.resize(num_shards * digest_size);
+
+  // Chunks and paddings between them cover the entire file.
+  extents.resize(out::chunks.size());
+  for (i64 i = 0; i < out::chunks.size(); i++) {
+    i64 begin = (i == 0) ? 0 : (i64)out::chunks[i]->shdr.sh_offset;
+    i64 end = (i == out::chunks.size() - 1)
+      ? filesize : (i64)out::chunks[i + 1]->shdr.sh_offset;
+    extents[i] = {begin, end};
+  }
+
+  for (i64 i = 0; i < out::chunks.size(); i++)
+    for (std::pair<i64, i64> r : get_shards_for(i))
+      for (i64 j = r.first; j < r.second; j++)
+        refcounts[j]++;
+}
+
+// This function is called after copy_buf() of the idx'th chunk is done
+// and the padding after it is cleared.
+void BuildIdSection::chunk_written(i64 idx) {
+  if (config.build_id == BuildIdKind::UUID)
+    return;
+
+  for (std::pair<i64, i64> r : get_shards_for(idx))
+    for (i64 j = r.first; j < r.second; j++)
+      if (refcounts[j].fetch_sub(1, std::memory_order_acq_rel) == 1)
+        hash_shard(j);
+}
+
+void BuildIdSection::write_buildid() {
+  u8 *buf = out::buf + shdr.sh_offset + HEADER_SIZE;
+
   if (config.build_id == BuildIdKind::UUID) {
-    if (!RAND_bytes(out::buf + shdr.sh_offset + HEADER_SIZE, 16))
+    if (!RAND_bytes(buf, 16))
       Fatal() << "RAND_bytes failed";
     return;
   }
 
-  // Modern x86 processors have purpose-built instructions to accelerate
-  // SHA256 computation, and SHA256 outperforms MD5 on such computers.
-  // So, we always compute SHA256 and truncate it if smaller digest was
-  // requested.
+  if (config.build_id == BuildIdKind::FAST) {
+    Hash128 h;
+    h.update(digests.data(), digests.size());
+    h.finish(buf);
+    return;
+  }
+
   u8 digest[SHA256_SIZE];
-  compute_sha256(out::buf, filesize, digest);
-  memcpy(out::buf + shdr.sh_offset + HEADER_SIZE, digest, get_buildid_size());
+  SHA256(digests.data(), digests.size(), digest);
+  memcpy(buf, digest, get_buildid_size());
+}
+
+// Compresses a piece of a section as a raw deflate stream. Each shard
+// is compressed independently and ends at a byte boundary, so shards
+// can simply be concatenated to form a single valid stream.
+static std::vector<u8> deflate_shard(u8 *data, i64 size, bool is_last) {
+  z_stream strm = {};
+  if (deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    Fatal() << "deflateInit2 failed";
+
+  // deflateBound() doesn't count the bytes for a sync flush.
+  std::vector<u8> buf(deflateBound(&strm, size) + 16);
+  strm.next_in = data;
+  strm.avail_in = size;
+  strm.next_out = buf.data();
+  strm.avail_out = buf.size();
+
+  int r = deflate(&strm, is_last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (r != (is_last ? Z_STREAM_END : Z_OK) || strm.avail_in)
+    Fatal() << "deflate failed";
+
+  buf.resize(strm.total_out);
+  deflateEnd(&strm);
+  return buf;
+}
+
+CompressedSection::CompressedSection(OutputChunk &chunk)
+  : OutputChunk(SYNTHETIC) {
+  name = chunk.name;
+  shndx = chunk.shndx;
+  shdr = chunk.shdr;
+  shdr.sh_flags |= SHF_COMPRESSED;
+  shdr.sh_addralign = 8;
+
+  chdr.ch_type = ELFCOMPRESS_ZLIB;
+  chdr.ch_size = chunk.shdr.sh_size;
+  chdr.ch_addralign = chunk.shdr.sh_addralign;
+
+  std::vector<u8> buf(chunk.shdr.sh_size);
+  chunk.write_to(buf.data());
+
+  static constexpr i64 SHARD_SIZE = 1024 * 1024;
+  i64 num_shards = (buf.size() + SHARD_SIZE - 1) / SHARD_SIZE;
+  shards.resize(num_shards);
+  std::vector<u32> adlers(num_shards);
+
+  tbb::parallel_for((i64)0, num_shards, [&](i64 i) {
+    u8 *begin = buf.data() + i * SHARD_SIZE;
+    i64 size = std::min<i64>(SHARD_SIZE, buf.size() - i * SHARD_SIZE);
+    shards[i] = deflate_shard(begin, size, i == num_shards - 1);
+    adlers[i] = adler32(1, begin, size);
+  });
+
+  checksum = adlers[0];
+  for (i64 i = 1; i < num_shards; i++) {
+    i64 size = std::min<i64>(SHARD_SIZE, buf.size() - i * SHARD_SIZE);
+    checksum = adler32_combine(checksum, adlers[i], size);
+  }
+
+  // A compression header, a zlib header, compressed data and a
+  // trailing Adler-32 checksum.
+  shdr.sh_size = sizeof(ElfChdr) + 2 + 4;
+  for (std::vector<u8> &shard : shards)
+    shdr.sh_size += shard.size();
+
+  static Counter uncompressed_bytes("uncompressed_debug_bytes");
+  static Counter compressed_bytes("compressed_debug_bytes");
+  uncompressed_bytes.inc(chdr.ch_size);
+  compressed_bytes.inc(shdr.sh_size);
+}
+
+void CompressedSection::copy_buf() {
+  u8 *base = out::buf + shdr.sh_offset;
+  memcpy(base, &chdr, sizeof(chdr));
+  base += sizeof(chdr);
+
+  // zlib header for deflate with a 32 KiB window
+  *base++ = 0x78;
+  *base++ = 0x01;
+
+  std::vector<i64> offsets(shards.size());
+  for (i64 i = 1; i < shards.size(); i++)
+    offsets[i] = offsets[i - 1] + shards[i - 1].size();
+
+  tbb::parallel_for((i64)0, (i64)shards.size(), [&](i64 i) {
+    memcpy(base + offsets[i], shards[i].data(), shards[i].size());
+  });
+
+  // Adler-32 is stored in big endian
+  base += offsets.back() + shards.back().size();
+  *base++ = checksum >> 24;
+  *base++ = checksum >> 16;
+  *base++ = checksum >> 8;
+  *base++ = checksum;
 }
@@ -5,6 +5,8 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <tbb/parallel_for.h>
+#include <unistd.h>
 
 static u32 get_umask() {
   u32 orig_umask = umask(0);
@@ -25,6 +27,7 @@ public:
     if (rename(config.output.c_str(), tmpfile) == 0) {
       ::close(fd);
       fd = ::open(tmpfile, O_RDWR | O_CREAT, 0777);
+      has_old_contents = (fd != -1);
       if (fd == -1) {
         if (errno != ETXTBSY)
           Error() << "cannot open " << config.output << ": " << strerror(errno);
@@ -38,6 +41,11 @@ public:
     if (ftruncate(fd, filesize))
       Error() << "ftruncate failed";
 
+    // Allocate disk blocks up front so that the file system doesn't
+    // have to do that on each page fault while we are writing to the
+    // file. Not all file systems support this, so errors are ignored.
+    fallocate(fd, 0, 0, filesize);
+
     if (fchmod(fd, (0777 & ~get_umask())) == -1)
       Error() << "fchmod failed";
 
@@ -47,6 +55,8 @@ public:
     ::close(fd);
   }
 
+  // We can't defer munmap until after the parent process exits. As long
+  // as a writable mapping exists, executing the output fails with ETXTBSY.
   void close() override {
     Timer t("munmap");
     munmap(buf, filesize);
@@ -72,9 +82,46 @@ public:
     if (fd == -1)
       Error() << "cannot open " << config.output << ": " << strerror(errno);
 
-    FILE *fp = fdopen(fd, "w");
-    fwrite(buf, filesize, 1, fp);
-    fclose(fp);
+    // If the file is seekable (e.g. a block device), write it in
+    // parallel. Otherwise (e.g. a pipe), write it sequentially.
+    if (lseek(fd, 0, SEEK_CUR) != -1)
+      pwrite_parallel(fd);
+    else
+      write_all(fd, buf, filesize);
+    ::close(fd);
+  }
+
+private:
+  static constexpr i64 CHUNK_SIZE = 16 * 1024 * 1024;
+
+  void pwrite_parallel(i64 fd) {
+    i64 num_chunks = (filesize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    tbb::parallel_for((i64)0, num_chunks, [&](i64 i) {
+      i64 offset = i * CHUNK_SIZE;
+      i64 end = std::min<i64>(offset + CHUNK_SIZE, filesize);
+
+      while (offset < end) {
+        i64 n = pwrite(fd, buf + offset, end - offset, offset);
+        if (n == -1 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          Fatal() << path << ": write failed: " << strerror(errno);
+        offset += n;
+      }
+    });
+  }
+
+  void write_all(i64 fd, u8 *data, i64 size) {
+    while (size > 0) {
+      i64 n = write(fd, data, size);
+      if (n == -1 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        Fatal() << path << ": write failed: " << strerror(errno);
+      data += n;
+      size -= n;
+    }
   }
 };
 
@@ -92,7 +139,9 @@ OutputFile *OutputFile::open(std::string path, u64 filesize) {
   else
     file = new MemoryMappedOutputFile(path, filesize);
 
-  if (config.filler != -1)
+  if (config.filler != -1) {
     memset(file->buf, config.filler, filesize);
+    file->has_old_contents = false;
+  }
   return file;
 }
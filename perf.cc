@@ -3,8 +3,12 @@
 #include <functional>
 #include <iomanip>
 #include <ios>
+#include <linux/perf_event.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <tbb/task_scheduler_observer.h>
 
 i64 Counter::get_value() {
   return values.combine(std::plus());
@@ -33,7 +37,76 @@ static i64 to_nsec(struct timeval t) {
   return (i64)t.tv_sec * 1000000000 + t.tv_usec * 1000;
 }
 
+// mimalloc is linked to mold as a replacement of malloc, but we don't
+// want to depend on its header. If it's not linked, this is null.
+extern "C" void mi_process_info(size_t *elapsed, size_t *utime, size_t *stime,
+                                size_t *rss, size_t *peak_rss, size_t *commit,
+                                size_t *peak_commit, size_t *faults)
+  __attribute__((weak));
+
+static int event_fds[PerfCounters::NUM_EVENTS] = {-1, -1, -1, -1, -1};
+
+static u64 cache_event(u64 cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// Opens hardware counters for this process. Threads created after this
+// function inherit the counters. Counters that the kernel or the
+// processor doesn't support are silently ignored.
+void PerfCounters::start() {
+  static const std::pair<u32, u64> events[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, cache_event(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+  };
+
+  for (i64 i = 0; i < NUM_EVENTS; i++) {
+    struct perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = events[i].first;
+    attr.config = events[i].second;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    event_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  enabled = true;
+}
+
+void PerfCounters::read() {
+  for (i64 i = 0; i < NUM_EVENTS; i++) {
+    u64 val;
+    if (event_fds[i] == -1 || ::read(event_fds[i], &val, 8) != 8)
+      events[i] = -1;
+    else
+      events[i] = val;
+  }
+
+  i64 pages = 0;
+  if (FILE *fp = fopen("/proc/self/statm", "r")) {
+    long size, resident;
+    if (fscanf(fp, "%ld %ld", &size, &resident) == 2)
+      pages = resident;
+    fclose(fp);
+  }
+  rss = pages * sysconf(_SC_PAGESIZE);
+
+  committed = -1;
+  if (mi_process_info) {
+    size_t elapsed, utime, stime, cur_rss, peak_rss, commit, peak_commit, faults;
+    mi_process_info(&elapsed, &utime, &stime, &cur_rss, &peak_rss, &commit,
+                    &peak_commit, &faults);
+    committed = commit;
+  }
+}
+
 TimerRecord::TimerRecord(std::string name) : name(name) {
+  if (PerfCounters::enabled)
+    counters_start.read();
+
   struct rusage usage;
   getrusage(RUSAGE_SELF, &usage);
 
@@ -53,6 +126,9 @@ void TimerRecord::stop() {
   end = now_nsec();
   user = to_nsec(usage.ru_utime) - user;
   sys = to_nsec(usage.ru_stime) - sys;
+
+  if (PerfCounters::enabled)
+    counters_end.read();
 }
 
 Timer::Timer(std::string name) {
@@ -79,17 +155,209 @@ void Timer::print() {
       if (records[i]->end < records[j]->end)
         depth[i]++;
 
-  std::cout << "     User   System     Real  Name\n";
+  std::cout << "     User   System     Real";
+  if (PerfCounters::enabled)
+    std::cout << "   Cycles   Instrs  LLCMiss  TLBMiss   Faults"
+              << "   RSS     +RSS   Commit";
+  std::cout << "  Name\n";
+
+  // Page faults are shown in thousands, other events in millions and
+  // memory sizes in MiB.
+  static const double units[] = {1e6, 1e6, 1e6, 1e6, 1e3};
+
+  auto print_delta = [](i64 start, i64 end, double unit) {
+    if (start == -1 || end == -1)
+      printf("        -");
+    else
+      printf(" % 8.1f", (double)(end - start) / unit);
+  };
 
   for (i64 i = 0; i < records.size(); i++) {
     TimerRecord &rec = *records[i];
-    printf(" % 8.3f % 8.3f % 8.3f  %s%s\n",
+    printf(" % 8.3f % 8.3f % 8.3f",
            ((double)rec.user / 1000000000),
            ((double)rec.sys / 1000000000),
-           (((double)rec.end - rec.start) / 1000000000),
-           std::string(depth[i] * 2, ' ').c_str(),
-           rec.name.c_str());
+           (((double)rec.end - rec.start) / 1000000000));
+
+    if (PerfCounters::enabled) {
+      PerfCounters &s = rec.counters_start;
+      PerfCounters &e = rec.counters_end;
+      for (i64 j = 0; j < PerfCounters::NUM_EVENTS; j++)
+        print_delta(s.events[j], e.events[j], units[j]);
+      print_delta(0, e.rss, 1024 * 1024);
+      print_delta(s.rss, e.rss, 1024 * 1024);
+      print_delta(0, e.committed, 1024 * 1024);
+    }
+
+    printf("  %s%s\n", std::string(depth[i] * 2, ' ').c_str(), rec.name.c_str());
+  }
+
+  std::cout << std::flush;
+}
+
+// --perf-trace writes timers, counters and per-thread activity in the
+// Chrome trace event format, which can be viewed with chrome://tracing
+// or ui.perfetto.dev.
+//
+// Timers are written as nested spans on the main thread. For TBB worker
+// threads, we record a span for each period during which a thread has
+// joined the task arena. Worker threads leave the arena when they run
+// out of tasks, so gaps between spans are times when a core was idle.
+struct ThreadSpan {
+  i64 tid;
+  i64 start;
+  i64 end;
+};
+
+class TraceObserver : public tbb::task_scheduler_observer {
+public:
+  void on_scheduler_entry(bool is_worker) override {
+    if (!is_worker)
+      return;
+    std::lock_guard lock(mu);
+    if (tid == -1) {
+      tid = open_spans.size() + 1;
+      open_spans.push_back(-1);
+    }
+    open_spans[tid - 1] = now_nsec();
+  }
+
+  void on_scheduler_exit(bool is_worker) override {
+    if (!is_worker || tid == -1)
+      return;
+    std::lock_guard lock(mu);
+    spans.push_back({tid, open_spans[tid - 1], now_nsec()});
+    open_spans[tid - 1] = -1;
+  }
+
+  // Closes spans of threads that are still in the arena.
+  std::vector<ThreadSpan> get_spans() {
+    std::lock_guard lock(mu);
+    std::vector<ThreadSpan> vec = spans;
+    for (i64 i = 0; i < open_spans.size(); i++)
+      if (open_spans[i] != -1)
+        vec.push_back({i + 1, open_spans[i], now_nsec()});
+    return vec;
+  }
+
+  static i64 get_tid() {
+    return (tid == -1) ? 0 : tid;
+  }
+
+  i64 num_threads() {
+    std::lock_guard lock(mu);
+    return open_spans.size();
   }
 
+private:
+  static inline thread_local i64 tid = -1;
+  std::mutex mu;
+  std::vector<ThreadSpan> spans;
+  std::vector<i64> open_spans;
+};
+
+static TraceObserver *observer;
+
+ParseTimer::ParseTimer(InputFile *file) : file(file), start(now_nsec()) {}
+
+ParseTimer::~ParseTimer() {
+  i64 end = now_nsec();
+  std::lock_guard lock(mu);
+  records.push_back({file, TraceObserver::get_tid(), start, end});
+}
+
+void ParseTimer::print() {
+  std::vector<Record> vec = records;
+  sort(vec, [](const Record &a, const Record &b) {
+    return a.end - a.start > b.end - b.start;
+  });
+
+  if (vec.size() > 10)
+    vec.resize(10);
+
+  std::cout << "\n     Real  Slowest files to parse\n";
+  for (Record &rec : vec)
+    std::cout << " " << std::fixed << std::setprecision(3) << std::setw(8)
+              << ((double)rec.end - rec.start) / 1000000000
+              << "  " << *rec.file << "\n";
   std::cout << std::flush;
 }
+
+void start_perf_trace() {
+  observer = new TraceObserver;
+  observer->observe(true);
+}
+
+static std::string quote(std::string_view str) {
+  std::string ret = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\')
+      ret += '\\';
+    ret += c;
+  }
+  return ret + "\"";
+}
+
+void write_perf_trace(std::string path) {
+  for (i64 i = Timer::records.size() - 1; i >= 0; i--)
+    Timer::records[i]->stop();
+
+  FILE *fp = fopen(path.c_str(), "w");
+  if (!fp)
+    Fatal() << "cannot open " << path << ": " << strerror(errno);
+
+  i64 base = Timer::records.empty() ? now_nsec() : Timer::records[0]->start;
+  auto ts = [&](i64 nsec) { return (double)(nsec - base) / 1000; };
+
+  const char *sep = "\n";
+  auto event = [&](std::string str) {
+    fprintf(fp, "%s  {%s}", sep, str.c_str());
+    sep = ",\n";
+  };
+
+  auto span = [&](std::string_view name, std::string_view cat, i64 tid,
+                  i64 start, i64 end) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%ld",
+             ts(start), ts(end) - ts(start), (long)tid);
+    event("\"name\":" + quote(name) + ",\"cat\":" + quote(cat) +
+          ",\"ph\":\"X\"," + buf);
+  };
+
+  auto thread_name = [&](i64 tid, std::string name) {
+    event("\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" +
+          std::to_string(tid) + ",\"args\":{\"name\":" + quote(name) + "}");
+  };
+
+  fprintf(fp, "{\"traceEvents\":[");
+
+  thread_name(0, "main");
+  for (TimerRecord *rec : Timer::records)
+    span(rec->name, "timer", 0, rec->start, rec->end);
+
+  if (observer) {
+    for (i64 i = 1; i <= observer->num_threads(); i++)
+      thread_name(i, "worker " + std::to_string(i));
+    for (ThreadSpan &s : observer->get_spans())
+      span("tbb", "worker", s.tid, s.start, s.end);
+  }
+
+  for (ParseTimer::Record &rec : ParseTimer::records) {
+    std::stringstream ss;
+    ss << *rec.file;
+    span(ss.str(), "parse", rec.tid, rec.start, rec.end);
+  }
+
+  // Counters only have final values, so they are shown as counter
+  // tracks that change once at the end of the link.
+  i64 end = Timer::records.empty() ? base : Timer::records[0]->end;
+  for (Counter *c : Counter::instances) {
+    char buf[100];
+    snprintf(buf, sizeof(buf), ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1", ts(end));
+    event("\"name\":" + quote(c->name) + buf + ",\"args\":{\"value\":" +
+          std::to_string(c->get_value()) + "}");
+  }
+
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+}
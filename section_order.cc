@@ -0,0 +1,286 @@
+// This file implements section reordering for better instruction
+// cache and TLB utilization at runtime. Input sections are sorted
+// within each output section either by --symbol-ordering-file or by
+// a call graph profile, and then by .text.hot/.text.unlikely prefixes
+// if -z hugepage-text is given.
+//
+// A call graph profile is a list of (caller, callee, weight) tuples.
+// It is read from .llvm.call-graph-profile sections, which clang emits
+// for profile-guided builds, or from --call-graph-ordering-file, whose
+// lines are of the form "caller callee weight" and can be created from
+// perf data. Sections connected by heavy edges are clustered with the
+// C3 heuristic described in Ottoni and Maher, "Optimizing Function
+// Placement for Large-Scale Data-Center Applications" (CGO 2017).
+
+#include "mold.h"
+
+#include <charconv>
+#include <tbb/parallel_for_each.h>
+#include <unordered_map>
+
+static std::vector<std::vector<std::string_view>>
+read_lines(std::string path) {
+  std::string_view data = MemoryMappedFile::must_open(path)->get_contents();
+  std::vector<std::vector<std::string_view>> lines;
+
+  while (!data.empty()) {
+    size_t pos = data.find('\n');
+    std::string_view line = data.substr(0, pos);
+    data = (pos == data.npos) ? "" : data.substr(pos + 1);
+
+    if (size_t pos = line.find('#'); pos != line.npos)
+      line = line.substr(0, pos);
+
+    std::vector<std::string_view> words;
+    while (!line.empty()) {
+      size_t begin = line.find_first_not_of(" \t\r");
+      if (begin == line.npos)
+        break;
+      size_t end = line.find_first_of(" \t\r", begin);
+      words.push_back(line.substr(begin, end - begin));
+      line = (end == line.npos) ? "" : line.substr(end);
+    }
+
+    if (!words.empty())
+      lines.push_back(words);
+  }
+  return lines;
+}
+
+// Sections containing symbols listed in a given file are placed first
+// in the order the symbols appear in the file.
+static bool order_by_symbol_file() {
+  std::unordered_map<std::string_view, i32> map;
+  i32 num_syms = 0;
+
+  for (std::span<std::string_view> words : read_lines(config.symbol_ordering_file)) {
+    if (words.size() != 1)
+      Fatal() << config.symbol_ordering_file << ": invalid line: " << words[0];
+    if (map.insert({words[0], num_syms}).second)
+      num_syms++;
+  }
+
+  // Local symbols are matched as well as global ones.
+  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
+    for (Symbol *sym : file->symbols) {
+      if (sym->file != file || !sym->input_section)
+        continue;
+      if (auto it = map.find(sym->name); it != map.end()) {
+        i32 &order = sym->input_section->order;
+        order = std::min(order, it->second - num_syms);
+      }
+    }
+  });
+  return num_syms > 0;
+}
+
+struct CallGraphEdge {
+  InputSection *from;
+  InputSection *to;
+  u64 weight;
+};
+
+static InputSection *get_section(Symbol *sym) {
+  if (!sym->file || sym->file->is_dso)
+    return nullptr;
+  return sym->input_section;
+}
+
+static std::vector<CallGraphEdge> read_call_graph_file() {
+  std::vector<CallGraphEdge> edges;
+  std::string &path = config.call_graph_ordering_file;
+
+  for (std::span<std::string_view> words : read_lines(path)) {
+    if (words.size() != 3)
+      Fatal() << path << ": invalid line: " << words[0];
+
+    u64 weight = 0;
+    std::string_view s = words[2];
+    if (std::from_chars(s.data(), s.data() + s.size(), weight).ptr != s.data() + s.size())
+      Fatal() << path << ": invalid weight: " << words[2];
+
+    InputSection *from = get_section(Symbol::intern(words[0]));
+    InputSection *to = get_section(Symbol::intern(words[1]));
+    if (from && to)
+      edges.push_back({from, to, weight});
+  }
+  return edges;
+}
+
+static std::vector<CallGraphEdge> read_call_graph_profile() {
+  std::vector<std::vector<CallGraphEdge>> vec(out::objs.size());
+
+  tbb::parallel_for((i64)0, (i64)out::objs.size(), [&](i64 i) {
+    ObjectFile *file = out::objs[i];
+    std::span<u64> weights = file->cg_profile_weights;
+    std::span<ElfRel> rels = file->cg_profile_rels;
+
+    if (weights.empty())
+      return;
+    if (rels.size() != weights.size() * 2)
+      Fatal() << *file << ": corrupted .llvm.call-graph-profile section";
+
+    for (i64 j = 0; j < weights.size(); j++) {
+      if (rels[j * 2].r_sym >= file->symbols.size() ||
+          rels[j * 2 + 1].r_sym >= file->symbols.size())
+        Fatal() << *file << ": invalid symbol index";
+
+      InputSection *from = get_section(file->symbols[rels[j * 2].r_sym]);
+      InputSection *to = get_section(file->symbols[rels[j * 2 + 1].r_sym]);
+      if (from && to)
+        vec[i].push_back({from, to, weights[j]});
+    }
+  });
+
+  std::vector<CallGraphEdge> edges;
+  for (std::vector<CallGraphEdge> &v : vec)
+    append(edges, v);
+  return edges;
+}
+
+// Clusters are merged unless a merged cluster gets too large or its
+// density drops too much compared to the predecessor's.
+static constexpr i64 MAX_CLUSTER_SIZE = 1024 * 1024;
+static constexpr i64 MAX_DENSITY_DEGRADATION = 8;
+
+struct Cluster {
+  double density() const {
+    return size ? (double)weight / size : 0;
+  }
+
+  std::vector<i32> sections;
+  i64 size = 0;
+  u64 weight = 0;
+  i32 best_pred = -1;
+  u64 best_pred_weight = 0;
+};
+
+static bool order_by_call_graph() {
+  std::vector<CallGraphEdge> edges;
+  if (!config.call_graph_ordering_file.empty())
+    edges = read_call_graph_file();
+  else if (config.call_graph_profile_sort)
+    edges = read_call_graph_profile();
+
+  if (edges.empty())
+    return false;
+
+  // Each section starts as a cluster of its own.
+  std::unordered_map<InputSection *, i32> map;
+  std::vector<InputSection *> sections;
+  std::vector<Cluster> clusters;
+
+  auto get_idx = [&](InputSection *isec) {
+    auto [it, inserted] = map.insert({isec, sections.size()});
+    if (inserted) {
+      sections.push_back(isec);
+      clusters.push_back({{it->second}, (i64)isec->shdr.sh_size});
+    }
+    return it->second;
+  };
+
+  for (CallGraphEdge &edge : edges) {
+    // Sections in different output sections can't be placed next to
+    // each other.
+    if (!edge.from->is_alive || !edge.to->is_alive ||
+        edge.from->output_section != edge.to->output_section)
+      continue;
+
+    i32 from = get_idx(edge.from);
+    i32 to = get_idx(edge.to);
+    clusters[to].weight += edge.weight;
+    if (from != to && clusters[to].best_pred_weight < edge.weight) {
+      clusters[to].best_pred = from;
+      clusters[to].best_pred_weight = edge.weight;
+    }
+  }
+
+  auto by_density = [&](i32 a, i32 b) {
+    return clusters[a].density() > clusters[b].density();
+  };
+
+  std::vector<i32> sorted(clusters.size());
+  for (i32 i = 0; i < sorted.size(); i++)
+    sorted[i] = i;
+  std::stable_sort(sorted.begin(), sorted.end(), by_density);
+
+  // leaders[i] is the cluster that section i currently belongs to.
+  std::vector<i32> leaders(clusters.size());
+  for (i32 i = 0; i < leaders.size(); i++)
+    leaders[i] = i;
+
+  auto get_leader = [&](i32 i) {
+    while (leaders[i] != i)
+      i = leaders[i] = leaders[leaders[i]];
+    return i;
+  };
+
+  // Append each cluster to the cluster of its most likely caller,
+  // in decreasing order of density.
+  for (i32 i : sorted) {
+    Cluster &c = clusters[i];
+    if (c.best_pred == -1 || c.density() == 0)
+      continue;
+
+    i32 pred_idx = get_leader(c.best_pred);
+    if (pred_idx == i)
+      continue;
+
+    Cluster &pred = clusters[pred_idx];
+    if (c.size + pred.size > MAX_CLUSTER_SIZE)
+      continue;
+
+    double density = (double)(pred.weight + c.weight) / (pred.size + c.size);
+    if (density < pred.density() / MAX_DENSITY_DEGRADATION)
+      continue;
+
+    leaders[i] = pred_idx;
+    append(pred.sections, c.sections);
+    pred.size += c.size;
+    pred.weight += c.weight;
+    c = {};
+  }
+
+  std::erase_if(sorted, [&](i32 i) { return clusters[i].sections.empty(); });
+  std::stable_sort(sorted.begin(), sorted.end(), by_density);
+
+  i32 order = -(i32)sections.size();
+  for (i32 i : sorted)
+    for (i32 j : clusters[i].sections)
+      sections[j]->order = order++;
+  return true;
+}
+
+// With -z hugepage-text, hot code is grouped at the beginning of the
+// text segment so that it is covered by as few huge pages as possible.
+static i64 get_temperature(InputSection *isec) {
+  if (!config.z_hugepage_text || !(isec->shdr.sh_flags & SHF_EXECINSTR))
+    return 0;
+  if (isec->name.starts_with(".text.hot"))
+    return -1;
+  if (isec->name.starts_with(".text.unlikely") ||
+      isec->name.starts_with(".text.cold"))
+    return 1;
+  return 0;
+}
+
+void order_sections() {
+  Timer t("order_sections");
+
+  bool ordered;
+  if (!config.symbol_ordering_file.empty())
+    ordered = order_by_symbol_file();
+  else
+    ordered = order_by_call_graph();
+
+  if (!ordered && !config.z_hugepage_text)
+    return;
+
+  tbb::parallel_for_each(OutputSection::instances, [](OutputSection *osec) {
+    std::stable_sort(osec->members.begin(), osec->members.end(),
+                     [](InputSection *a, InputSection *b) {
+      return std::tuple(a->order, get_temperature(a)) <
+             std::tuple(b->order, get_temperature(b));
+    });
+  });
+}
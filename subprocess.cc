@@ -1,6 +1,5 @@
 #include "mold.h"
 
-#include <openssl/sha.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -9,7 +8,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-#define DAEMON_TIMEOUT 30
+#define DAEMON_TIMEOUT 300
 
 // Exiting from a program with large memory usage is slow --
 // it may take a few hundred milliseconds. To hide the latency,
@@ -48,41 +47,17 @@ std::function<void()> fork_child() {
   return [=]() { write(pipefd[1], (char []){1}, 1); };
 }
 
-static std::string base64(u8 *data, u64 size) {
-  static const char chars[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+_";
-
-  std::ostringstream out;
-
-  auto encode = [&](u32 x) {
-    out << chars[x & 0b111111]
-        << chars[(x >> 6) & 0b111111]
-        << chars[(x >> 12) & 0b111111]
-        << chars[(x >> 18) & 0b111111];
-  };
-
-  i64 i = 0;
-  for (; i < size - 3; i += 3)
-    encode((data[i + 2] << 16) | (data[i + 1] << 8) | data[i]);
-
-  if (i == size - 1)
-    encode(data[i]);
-  else if (i == size - 2)
-    encode((data[i + 1] << 8) | data[i]);
-  return out.str();
-}
-
-static std::string compute_sha256(char **argv) {
-  SHA256_CTX ctx;
-  SHA256_Init(&ctx);
-
-  for (i64 i = 0; argv[i]; i++)
-    if (!strcmp(argv[i], "-preload") && !strcmp(argv[i], "--preload"))
-      SHA256_Update(&ctx, argv[i], strlen(argv[i]) + 1);
-
-  u8 digest[SHA256_SIZE];
-  SHA256_Final(digest, &ctx);
-  return base64(digest, SHA256_SIZE);
+// All links of the same user are served by a single server process,
+// whatever their command lines are. The socket name includes the
+// identity of the mold executable so that a stale server doesn't
+// serve links after mold is rebuilt.
+static std::string get_socket_path() {
+  struct stat st;
+  if (stat("/proc/self/exe", &st) == -1)
+    Fatal() << "/proc/self/exe: stat failed: " << strerror(errno);
+
+  return "/tmp/mold-" + std::to_string(getuid()) + "-" +
+         std::to_string(st.st_ino) + "-" + std::to_string(st.st_mtime);
 }
 
 static void send_fd(i64 conn, i64 fd) {
@@ -132,12 +107,64 @@ static i64 recv_fd(i64 conn) {
   return *(int *)CMSG_DATA(cmsg);
 }
 
+static void write_all(i64 fd, const void *data, u64 size) {
+  for (u64 i = 0; i < size;) {
+    i64 n = write(fd, (char *)data + i, size - i);
+    if (n <= 0)
+      Fatal() << "write failed: " << strerror(errno);
+    i += n;
+  }
+}
+
+static void read_all(i64 fd, void *data, u64 size) {
+  for (u64 i = 0; i < size;) {
+    i64 n = read(fd, (char *)data + i, size - i);
+    if (n <= 0)
+      Fatal() << "read failed: " << strerror(errno);
+    i += n;
+  }
+}
+
+// A client sends its current directory and command line arguments
+// to the server as a sequence of NUL-terminated strings.
+static void send_args(i64 conn, char **argv) {
+  char *cwd = getcwd(nullptr, 0);
+  std::string buf = std::string(cwd) + '\0';
+  free(cwd);
+
+  for (i64 i = 0; argv[i]; i++)
+    buf += std::string(argv[i]) + '\0';
+
+  u64 size = buf.size();
+  write_all(conn, &size, sizeof(size));
+  write_all(conn, buf.data(), size);
+}
+
+static char **recv_args(i64 conn) {
+  u64 size;
+  read_all(conn, &size, sizeof(size));
+
+  char *buf = (char *)malloc(size);
+  read_all(conn, buf, size);
+
+  std::vector<char *> vec;
+  for (char *p = buf; p < buf + size; p += strlen(p) + 1)
+    vec.push_back(p);
+
+  if (vec.empty() || chdir(vec[0]) == -1)
+    Fatal() << "cannot change directory: " << strerror(errno);
+
+  char **argv = (char **)calloc(vec.size(), sizeof(char *));
+  std::copy(vec.begin() + 1, vec.end(), argv);
+  return argv;
+}
+
 bool resume_daemon(char **argv, i64 *code) {
   i64 conn = socket(AF_UNIX, SOCK_STREAM, 0);
   if (conn == -1)
     Error() << "socket failed: " << strerror(errno);
 
-  std::string path = "/tmp/mold-" + compute_sha256(argv);
+  std::string path = get_socket_path();
 
   struct sockaddr_un name = {};
   name.sun_family = AF_UNIX;
@@ -150,13 +177,23 @@ bool resume_daemon(char **argv, i64 *code) {
 
   send_fd(conn, STDOUT_FILENO);
   send_fd(conn, STDERR_FILENO);
+  send_args(conn, argv);
   i64 r = read(conn, (char[1]){}, 1);
   *code = (r != 1);
   return true;
 }
 
-void daemonize(char **argv, std::function<void()> *wait_for_client,
-               std::function<void()> *on_complete) {
+// Starts a server process that serves any number of links. The server
+// calls `preload` once at startup and again before serving each client,
+// so that it can parse new or updated input files and keep them in
+// memory. For each client, the server forks a child which shares the
+// preloaded files with the server and does the actual linking.
+// This function returns in the child with the client's argv.
+//
+// Note that TBB worker threads don't survive fork(). `preload` must not
+// start them, or children would end up running on a single thread.
+char **daemonize(std::function<void()> preload,
+                 std::function<void()> *on_complete) {
   if (daemon(1, 0) == -1)
     Error() << "daemon failed: " << strerror(errno);
 
@@ -164,7 +201,7 @@ void daemonize(char **argv, std::function<void()> *wait_for_client,
   if (sock == -1)
     Error() << "socket failed: " << strerror(errno);
 
-  socket_tmpfile = strdup(("/tmp/mold-" + compute_sha256(argv)).c_str());
+  socket_tmpfile = strdup(get_socket_path().c_str());
 
   struct sockaddr_un name = {};
   name.sun_family = AF_UNIX;
@@ -183,12 +220,15 @@ void daemonize(char **argv, std::function<void()> *wait_for_client,
 
   umask(orig_mask);
 
-  if (listen(sock, 0) == -1)
+  if (listen(sock, SOMAXCONN) == -1)
     Error() << "listen failed: " << strerror(errno);
 
-  static i64 conn = -1;
+  // Children are reaped automatically.
+  signal(SIGCHLD, SIG_IGN);
+
+  preload();
 
-  *wait_for_client = [=]() {
+  for (;;) {
     fd_set rfds;
     FD_ZERO(&rfds);
     FD_SET(sock, &rfds);
@@ -198,22 +238,42 @@ void daemonize(char **argv, std::function<void()> *wait_for_client,
     tv.tv_usec = 0;
 
     i64 res = select(sock + 1, &rfds, NULL, NULL, &tv);
-    if (res == -1)
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
       Error() << "select failed: " << strerror(errno);
+    }
 
     if (res == 0) {
-      std::cout << "timeout\n";
+      unlink(socket_tmpfile);
       exit(0);
     }
 
-    conn = accept(sock, NULL, NULL);
+    i64 conn = accept(sock, NULL, NULL);
     if (conn == -1)
-      Error() << "accept failed: " << strerror(errno);
-    unlink(socket_tmpfile);
+      continue;
+
+    // Pick up input files that have changed since the last link.
+    preload();
+
+    pid_t pid = fork();
+    if (pid == -1)
+      Error() << "fork failed: " << strerror(errno);
+
+    if (pid > 0) {
+      // Server
+      close(conn);
+      continue;
+    }
+
+    // Child
+    close(sock);
+    signal(SIGCHLD, SIG_DFL);
+    socket_tmpfile = nullptr;
 
     dup2(recv_fd(conn), STDOUT_FILENO);
     dup2(recv_fd(conn), STDERR_FILENO);
-  };
-
-  *on_complete = [=]() { write(conn, (char []){1}, 1); };
+    *on_complete = [=]() { write(conn, (char []){1}, 1); };
+    return recv_args(conn);
+  }
 }
@@ -0,0 +1,44 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -x assembler -
+  .text
+  .globl _start
+_start:
+  call foo
+  mov %eax, %edi
+  mov \$60, %eax
+  syscall
+EOF
+
+# unused.o is not referenced, foo.o is referenced by a.o, and bar.o is
+# referenced only by foo.o.
+cat <<EOF | cc -o $t/unused.o -c -xc -
+int baz() { return 1; }
+EOF
+
+cat <<EOF | cc -o $t/foo.o -c -xc -
+int bar();
+int foo() { return bar() + 2; }
+EOF
+
+cat <<EOF | cc -o $t/bar.o -c -xc -
+int bar() { return 3; }
+EOF
+
+rm -f $t/d.a
+(cd $t; ar rcs d.a unused.o foo.o bar.o)
+
+../mold -static --trace --stat -o $t/exe $t/a.o $t/d.a > $t/log
+
+fgrep -q 'archive-lazy/d.a(foo.o)' $t/log
+fgrep -q 'archive-lazy/d.a(bar.o)' $t/log
+! fgrep -q 'archive-lazy/d.a(unused.o)' $t/log || false
+grep -q 'parsed_objs=3$' $t/log
+
+[ "$($t/exe; echo $?)" = 5 ]
+
+echo OK
@@ -21,4 +21,7 @@ readelf -n $t/exe | grep -q 'GNU.*0x00000014.*NT_GNU_BUILD_ID'
 clang -o $t/exe $t/a.c -fuse-ld=`pwd`/../mold -Wl,-build-id=sha256
 readelf -n $t/exe | grep -q 'GNU.*0x00000020.*NT_GNU_BUILD_ID'
 
+clang -o $t/exe $t/a.c -fuse-ld=`pwd`/../mold -Wl,-build-id=fast
+readelf -n $t/exe | grep -q 'GNU.*0x00000010.*NT_GNU_BUILD_ID'
+
 echo OK
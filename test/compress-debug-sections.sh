@@ -0,0 +1,32 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -g -xc -
+#include <stdio.h>
+static int foo(int x) { return x * 3; }
+int main() { printf("Hello world\n"); return foo(0); }
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe1 $t/a.o
+clang -fuse-ld=`pwd`/../mold -o $t/exe2 $t/a.o \
+  -Wl,--compress-debug-sections=zlib
+
+$t/exe2 | grep -q 'Hello world'
+
+! readelf -SW $t/exe1 | grep -q '\.debug_info .* C '
+readelf -SW $t/exe2 | grep -q '\.debug_info .* C '
+
+# Decompressed contents are the same as uncompressed ones.
+readelf --debug-dump=info $t/exe1 | grep -v 'exe1' > $t/info1
+readelf --debug-dump=info $t/exe2 | grep -v 'exe2' > $t/info2
+diff -q $t/info1 $t/info2
+
+objcopy --decompress-debug-sections $t/exe2 $t/exe3
+objcopy --dump-section .debug_info=$t/info3 $t/exe1
+objcopy --dump-section .debug_info=$t/info4 $t/exe3
+cmp $t/info3 $t/info4
+
+echo OK
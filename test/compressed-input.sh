@@ -0,0 +1,23 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -g -gz -xc -
+#include <stdio.h>
+static int foo(int x) { return x * 3; }
+int main() { printf("Hello world\n"); return foo(0); }
+EOF
+
+readelf -SW $t/a.o | grep -q '\.debug_str .* MSC '
+objcopy --decompress-debug-sections $t/a.o $t/b.o
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe1 $t/a.o
+clang -fuse-ld=`pwd`/../mold -o $t/exe2 $t/b.o
+
+$t/exe1 | grep -q 'Hello world'
+! readelf -SW $t/exe1 | grep -q '\.debug_info .* C '
+cmp $t/exe1 $t/exe2
+
+echo OK
@@ -0,0 +1,19 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -g -xc -
+static int foo(int x) { return x * 3; }
+int main() { return foo(0); }
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe $t/a.o
+
+# DW_AT_low_pc of main refers to .text plus an addend.
+addr=$(nm $t/exe | grep ' T main$' | cut -d' ' -f1 | sed 's/^0*//')
+readelf --debug-dump=info $t/exe | grep -A8 'DW_AT_name.*: main$' |
+  grep -q "DW_AT_low_pc *: 0x$addr"
+
+echo OK
@@ -0,0 +1,91 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+# The second .eh_frame is empty, so it begins at the same input address
+# as the third one.
+cat <<EOF | cc -o $t/a.o -c -x assembler -
+  .text
+fn1:
+  ret
+fn2:
+  ret
+
+  .section .eh_frame,"a",@unwind,unique,1
+cie1:
+  .long 0x14
+  .long 0
+  .byte 1
+  .string "zR"
+  .uleb128 1
+  .sleb128 -8
+  .uleb128 16
+  .uleb128 1
+  .byte 0x1b
+  .byte 0xc, 7, 8
+  .byte 0x90, 1
+  .byte 0, 0
+fde1:
+  .long 0x10
+  .long fde1 + 4 - cie1
+  .long fn1 - .
+  .long 1
+  .uleb128 0
+  .byte 0, 0, 0
+
+  .section .eh_frame,"a",@unwind,unique,2
+
+  .section .eh_frame,"a",@unwind,unique,3
+cie2:
+  .long 0x14
+  .long 0
+  .byte 1
+  .string "zR"
+  .uleb128 1
+  .sleb128 -8
+  .uleb128 16
+  .uleb128 1
+  .byte 0x1b
+  .byte 0xc, 7, 8
+  .byte 0x90, 1
+  .byte 0, 0
+fde2:
+  .long 0x10
+  .long fde2 + 4 - cie2
+  .long fn2 - .
+  .long 1
+  .uleb128 0
+  .byte 0, 0, 0
+
+  .data
+  .globl ptrs
+ptrs:
+  .quad cie1
+  .quad fde1
+  .quad cie2
+  .quad fde2
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+extern unsigned *ptrs[];
+
+int is_cie(unsigned *p) {
+  return p[0] == 0x14 && p[1] == 0;
+}
+
+int is_fde(unsigned *p, unsigned *cie) {
+  return p[0] == 0x10 && p[1] == (char *)(p + 1) - (char *)cie;
+}
+
+int main() {
+  return !(is_cie(ptrs[0]) && is_fde(ptrs[1], ptrs[0]) &&
+           is_cie(ptrs[2]) && is_fde(ptrs[3], ptrs[2]));
+}
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe $t/a.o $t/b.o
+$t/exe
+
+echo OK
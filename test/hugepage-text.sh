@@ -0,0 +1,28 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -O2 -ffunction-sections -xc -
+#include <stdio.h>
+__attribute__((cold)) void cold_fn() { puts("cold"); }
+__attribute__((hot)) void hot_fn() { puts("hot"); }
+int main() { hot_fn(); return 0; }
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe $t/a.o -Wl,-z,hugepage-text
+$t/exe | grep -q hot
+
+# The executable segment is aligned to 2 MiB in both memory and file.
+readelf -lW $t/exe | grep 'LOAD .* R E 0x200000$' > $t/load
+grep -Eq '0x[0-9a-f]*00000 0x[0-9a-f]*[02468ace]00000 ' $t/load
+
+addr() {
+  nm $t/exe | grep " $1\$" | cut -d' ' -f1
+}
+
+[[ $(addr hot_fn) < $(addr main) ]]
+[[ $(addr main) < $(addr cold_fn) ]]
+
+echo OK
@@ -0,0 +1,57 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+# Identical read-only data. The address of baz is taken.
+cat <<EOF > $t/a.s
+  .section .rodata.foo,"a",@progbits
+  .globl foo
+foo:
+  .quad 42
+
+  .section .rodata.bar,"a",@progbits
+  .globl bar
+bar:
+  .quad 42
+
+  .section .rodata.baz,"a",@progbits
+  .globl baz
+baz:
+  .quad 42
+
+  .addrsig
+  .addrsig_sym baz
+EOF
+
+llvm-mc -filetype=obj -triple=x86_64-unknown-linux-gnu -o $t/a.o $t/a.s
+
+# This file doesn't have .llvm_addrsig.
+cat <<EOF | cc -o $t/b.o -c -fdata-sections -xc -
+const long qux = 42;
+const long quux = 42;
+int main() {}
+EOF
+
+addr() {
+  nm $1 | grep " $2\$" | cut -d' ' -f1
+}
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe1 $t/a.o $t/b.o -Wl,--icf=safe
+$t/exe1
+[[ $(addr $t/exe1 foo) == $(addr $t/exe1 bar) ]]
+[[ $(addr $t/exe1 foo) != $(addr $t/exe1 baz) ]]
+[[ $(addr $t/exe1 qux) != $(addr $t/exe1 quux) ]]
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe2 $t/a.o $t/b.o -Wl,--icf=all
+$t/exe2
+[[ $(addr $t/exe2 foo) == $(addr $t/exe2 baz) ]]
+[[ $(addr $t/exe2 foo) == $(addr $t/exe2 qux) ]]
+[[ $(addr $t/exe2 qux) == $(addr $t/exe2 quux) ]]
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe3 $t/a.o $t/b.o -Wl,--icf=none
+$t/exe3
+[[ $(addr $t/exe3 foo) != $(addr $t/exe3 bar) ]]
+
+echo OK
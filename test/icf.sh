@@ -0,0 +1,34 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF > $t/a.c
+#include <stdio.h>
+
+int fn1(int x) { return x * 3 + 7; }
+int fn2(int x) { return x * 3 + 7; }
+int fn3(int x) { return x * 5 + 1; }
+
+int (*volatile p1)(int) = fn1;
+int (*volatile p2)(int) = fn2;
+int (*volatile p3)(int) = fn3;
+
+int main() {
+  printf("%d %d\n", p1 == p2, p1 == p3);
+}
+EOF
+
+cflags="-ffunction-sections -fuse-ld=`pwd`/../mold"
+
+clang -o $t/exe1 $t/a.c $cflags -Wl,-icf
+$t/exe1 | grep -q '1 0'
+
+clang -o $t/exe2 $t/a.c $cflags -Wl,-icf -Wl,-icf-hash=sha256
+$t/exe2 | grep -q '1 0'
+
+clang -o $t/exe3 $t/a.c $cflags
+$t/exe3 | grep -q '0 0'
+
+echo OK
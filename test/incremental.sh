@@ -0,0 +1,61 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+rm -f $t/exe $t/exe.mold-state
+
+link() {
+  ../mold -static -incremental -stat -o $t/exe \
+    /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbeginT.o \
+    $t/a.o $t/b.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc_eh.a \
+    /usr/lib/x86_64-linux-gnu/libc.a \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o
+}
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+void foo();
+int main() { foo(); }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <stdio.h>
+void foo() { printf("foo1\n"); }
+EOF
+
+link > /dev/null
+[ -f $t/exe.mold-state ]
+$t/exe | grep -q 'foo1'
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <stdio.h>
+void foo() { printf("foo2\n"); }
+EOF
+
+link | grep -q 'incremental_reused_sections=[1-9]'
+$t/exe | grep -q 'foo2'
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+#include <stdio.h>
+void foo() { printf("foo3 %d %d %d %d\n", 1, 2, 3, 4); }
+EOF
+
+link > /dev/null
+$t/exe | grep -q 'foo3 1 2 3 4'
+
+# A failed write is reported and leaves no truncated state behind.
+ln -sf /dev/full $t/exe.mold-state.tmp
+! link > /dev/null 2>&1 || false
+! [ -e $t/exe.mold-state ] || false
+! [ -e $t/exe.mold-state.tmp ] || false
+
+link > /dev/null
+[ -f $t/exe.mold-state ]
+$t/exe | grep -q 'foo3 1 2 3 4'
+
+echo OK
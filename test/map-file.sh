@@ -0,0 +1,26 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -ffunction-sections -xc -
+int foo() { return 3; }
+int main() { return foo() - 3; }
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe $t/a.o -Wl,-Map=$t/map
+$t/exe
+
+grep -q '^ *[0-9]* *[0-9]* *[0-9]* \.text$' $t/map
+grep -q ' .*/a.o:(.text.foo)$' $t/map
+grep -q ' foo$' $t/map
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe $t/a.o -Wl,-Map=$t/map.json \
+  -Wl,--map-format=json
+
+grep -q '^{"output_sections":\[' $t/map.json
+grep -q '"section":".text.foo"' $t/map.json
+grep -q '"symbols":\[{"name":"foo","addr":[0-9]*}\]' $t/map.json
+
+echo OK
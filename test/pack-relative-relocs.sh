@@ -0,0 +1,51 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -fPIE -xc -
+#include <stdio.h>
+int a, b, c;
+int *ptrs[] = { &a, &b, &c, &a, &b, &c, &a, 0, &b };
+static const char *strs[] = { "foo", "bar", "baz" };
+
+int main() {
+  int n = 0;
+  for (int i = 0; i < 9; i++)
+    if (ptrs[i])
+      n++;
+  printf("%d %s %s %s %d\n", n, strs[0], strs[1], strs[2], ptrs[3] == &a);
+}
+EOF
+
+clang -fuse-ld=`pwd`/../mold -pie -o $t/exe1 $t/a.o
+clang -fuse-ld=`pwd`/../mold -pie -o $t/exe2 $t/a.o -Wl,-z,pack-relative-relocs
+
+$t/exe1 | grep -q '8 foo bar baz 1'
+$t/exe2 | grep -q '8 foo bar baz 1'
+
+readelf -rW $t/exe1 | grep -q R_X86_64_RELATIVE
+! readelf -rW $t/exe2 | grep -q R_X86_64_RELATIVE
+readelf -d $t/exe2 | grep -q '(RELR)'
+readelf -V $t/exe2 | grep -q GLIBC_ABI_DT_RELR
+
+# GLIBC_ABI_DT_RELR is needed even if no other symbol is versioned.
+cat <<EOF | cc -o $t/b.o -c -x assembler -
+  .globl _start
+_start:
+  mov \$60, %eax
+  xor %edi, %edi
+  syscall
+  .data
+  .p2align 3
+ptr:
+  .quad ptr
+EOF
+
+clang -fuse-ld=`pwd`/../mold -pie -nostartfiles -o $t/exe3 $t/b.o \
+  -Wl,-z,pack-relative-relocs -Wl,--no-as-needed -lc
+$t/exe3
+readelf -V $t/exe3 | grep -q GLIBC_ABI_DT_RELR
+
+echo OK
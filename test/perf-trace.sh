@@ -0,0 +1,17 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+echo 'int main() { return 0; }' > $t/a.c
+
+clang -o $t/exe $t/a.c -fuse-ld=`pwd`/../mold -Wl,-perf-trace=$t/trace.json
+$t/exe
+
+grep -q '"traceEvents"' $t/trace.json
+grep -q '"name":"copy_buf","cat":"timer","ph":"X"' $t/trace.json
+grep -q '"ph":"C"' $t/trace.json
+grep -q '"cat":"parse","ph":"X"' $t/trace.json
+
+echo OK
@@ -19,35 +19,63 @@ msg:
   .string "Hello world\n"
 EOF
 
-rm -f $t/exe
-
-../mold -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
-  /usr/lib/x86_64-linux-gnu/crti.o \
-  /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
-  $t/a.o \
-  /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
-  /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
-  /lib/x86_64-linux-gnu/libc.so.6 \
-  /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
-  /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
-  /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
-  /usr/lib/x86_64-linux-gnu/crtn.o \
-  -preload
+rm -f $t/exe $t/exe2
 
-! [ -e $t/exe ]
+link() {
+  ../mold /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    $t/a.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o "$@"
+}
+
+trap 'pkill -f -- "-o $t/exe -preload" || true' EXIT
 
-../mold -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
-  /usr/lib/x86_64-linux-gnu/crti.o \
-  /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
-  $t/a.o \
-  /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
-  /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
-  /lib/x86_64-linux-gnu/libc.so.6 \
-  /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
-  /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
-  /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
-  /usr/lib/x86_64-linux-gnu/crtn.o
+link -o $t/exe -preload
+! [ -e $t/exe ]
 
+link -o $t/exe
 $t/exe | grep -q 'Hello world'
 
+# The server keeps running and serves more than one client, even if
+# they have different command lines. Preloaded files are reused, and
+# files the server doesn't have are parsed by the client.
+cat <<EOF | cc -o $t/b.o -c -xc -
+int foo() { return 0; }
+EOF
+
+link -o $t/exe2 -stat $t/b.o > $t/stat2 &
+pid=$!
+link -o $t/exe3 -build-id -stat > $t/stat3
+wait $pid
+$t/exe2 | grep -q 'Hello world'
+$t/exe3 | grep -q 'Hello world'
+grep -q 'preloaded_files=[1-9]' $t/stat2
+grep -q 'preloaded_files=[1-9]' $t/stat3
+
+# Updated input files are picked up.
+cat <<EOF | cc -o $t/a.o -c -x assembler -
+  .text
+  .globl main
+main:
+  lea msg(%rip), %rdi
+  xor %rax, %rax
+  call printf@PLT
+  xor %rax, %rax
+  ret
+
+  .data
+msg:
+  .string "Hello mold\n"
+EOF
+
+link -o $t/exe
+$t/exe | grep -q 'Hello mold'
+
 echo OK
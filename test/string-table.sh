@@ -0,0 +1,37 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -fPIC -o $t/a.o -c -xc -
+void foobar() {}
+void bar() {}
+EOF
+
+cat <<EOF | cc -fPIC -o $t/b.o -c -xc -
+static void bar2() {}
+void foobar2() { bar2(); }
+int main() {}
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe $t/a.o $t/b.o -Wl,-export-dynamic
+$t/exe
+
+readelf -sW $t/exe > $t/log
+grep -q ' bar$' $t/log
+grep -q ' bar2$' $t/log
+grep -q ' foobar$' $t/log
+grep -q ' foobar2$' $t/log
+
+# "bar" and "bar2" share bytes with "foobar" and "foobar2".
+readelf -p .strtab $t/exe > $t/log
+grep -q ' foobar$' $t/log
+! grep -q ' bar$' $t/log
+! grep -q ' bar2$' $t/log
+
+readelf -p .dynstr $t/exe > $t/log
+grep -q ' foobar$' $t/log
+! grep -q ' bar$' $t/log
+
+echo OK
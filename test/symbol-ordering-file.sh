@@ -0,0 +1,49 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ... "
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -ffunction-sections -xc -
+void foo() {}
+void bar() {}
+static void baz() {}
+void qux() { baz(); }
+int main() { foo(); bar(); qux(); }
+EOF
+
+addr() {
+  nm $1 | grep " $2\$" | cut -d' ' -f1
+}
+
+cat <<EOF > $t/order
+qux
+# comment
+baz
+foo
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe1 $t/a.o \
+  -Wl,--symbol-ordering-file=$t/order
+$t/exe1
+
+[[ $(addr $t/exe1 qux) < $(addr $t/exe1 baz) ]]
+[[ $(addr $t/exe1 baz) < $(addr $t/exe1 foo) ]]
+[[ $(addr $t/exe1 foo) < $(addr $t/exe1 bar) ]]
+[[ $(addr $t/exe1 foo) < $(addr $t/exe1 main) ]]
+
+# Callees are placed right after their callers.
+cat <<EOF > $t/callgraph
+main bar 100
+bar foo 50
+EOF
+
+clang -fuse-ld=`pwd`/../mold -o $t/exe2 $t/a.o \
+  -Wl,--call-graph-ordering-file=$t/callgraph
+$t/exe2
+
+[[ $(addr $t/exe2 main) < $(addr $t/exe2 bar) ]]
+[[ $(addr $t/exe2 bar) < $(addr $t/exe2 foo) ]]
+[[ $(addr $t/exe2 foo) < $(addr $t/exe2 qux) ]]
+
+echo OK